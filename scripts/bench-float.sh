@@ -0,0 +1,26 @@
+#!/bin/bash
+# Compares the floating-point decoder in `ber-float` with the fixed-point one
+# in `ber`: total errors, and throughput in millions of samples per second
+# averaged over all points. Arguments are passed on to `ber` (for example,
+# `-j 1` for steadier timings).
+set -euo pipefail
+temp=$(mktemp -d)
+here="$(dirname "$0")"
+${TRAP:-trap} "rm -rf $temp" EXIT
+
+summarize ()
+{
+    awk -v name="$1" '
+        /^#/ { next }
+        { errors += $9 ; msps += $11 ; points++ }
+        END { printf "%-16s %8d %10.2f\n", name, errors, msps / points }
+    ' "$2"
+}
+
+printf "%-16s %8s %10s\n" "#decoder" "errors" "Msps/point"
+
+$here/../ber -t "$@" > $temp/fixed
+summarize fixed $temp/fixed
+
+$here/../ber-float -t "$@" > $temp/float
+summarize float $temp/float
@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+# Compares the speed of the generic decoder against the variants specialized
+# for particular framings and window sizes, which `listen` selects by default.
+set -euo pipefail
+here=$(dirname $0)
+byte_count=${1:-20000}
+
+temp=$(mktemp -d)
+${TRAP:-trap} "rm -rf $temp" EXIT
+
+head -c $byte_count /dev/urandom | LC_ALL=C tr -c '[:graph:]' ' ' > $temp/str || true
+$here/../gen -F $temp/str > $temp/audio
+
+TIMEFORMAT=%R
+for window in 5 6 7 8
+do
+    generic=$( { time $here/../listen -g -W $window < $temp/audio > $temp/generic ; } 2>&1 )
+    special=$( { time $here/../listen    -W $window < $temp/audio > $temp/special ; } 2>&1 )
+    cmp --quiet $temp/generic $temp/special || { echo "outputs differ for window $window" ; false ; }
+    printf "window %d: generic %6.3fs, specialized %6.3fs (%s)\n" $window $generic $special \
+        $(awk "BEGIN { printf \"%.2fx\", $generic / $special }")
+done
@@ -58,24 +58,28 @@ do
         noise $(compute_duration $byte_count) $noise_level > $noise
         mix $rand.audio $noise > $rand.audio.noised-$noise_level
 
-        for threshold in 1 16 256 1024
+        # `listen-ema` replaces the power window with a moving average
+        for listen in listen listen-ema
         do
-            for window in {5..8} # 8 is the hardcoded maximum in the embedded code at this time
+            for threshold in 1 16 256 1024
             do
-                for hysteresis in {4..11}
+                for window in {5..8} # 8 is the hardcoded maximum for the windowed power estimate
                 do
-                    for offset in {1..15}
+                    for hysteresis in {4..11}
                     do
-                        (
-                            out=$outdir/bits_per_sample$bits_per_sample/chan$channel/run$run.$stem/noise$noise_level/window$window/threshold$threshold/hysteresis$hysteresis/offset$offset/$stem.decoded
-                            mkdir -p $(dirname $out)
-                            if [[ ! -e $out ]] # assume existence implies previous completion
-                            then
-                                $here/../listen -C $channel -W $window -T $threshold -H $hysteresis -O $offset < $rand.audio.noised-$noise_level 2> /dev/null > $out
-                            fi
-                        ) &
+                        for offset in {1..15}
+                        do
+                            (
+                                out=$outdir/bits_per_sample$bits_per_sample/chan$channel/run$run.$stem/noise$noise_level/$listen/window$window/threshold$threshold/hysteresis$hysteresis/offset$offset/$stem.decoded
+                                mkdir -p $(dirname $out)
+                                if [[ ! -e $out ]] # assume existence implies previous completion
+                                then
+                                    $here/../$listen -C $channel -W $window -T $threshold -H $hysteresis -O $offset < $rand.audio.noised-$noise_level 2> /dev/null > $out
+                                fi
+                            ) &
+                        done
+                        wait
                     done
-                    wait
                 done
             done
         done
@@ -0,0 +1,107 @@
+#!/bin/bash
+# Measures how long bytes take to come through `gen` and `listen`, for several
+# decoder configurations, with `listen` reading directly and pipelined (-p).
+# Two latencies are reported for each byte, in milliseconds:
+#   decode    from the first sample of its start bit (`gen -t`) to the input
+#             sample that completed it (`listen -t`): what the decoder itself
+#             costs, from its window, filters, offset and stop-bit check
+#   delivery  from the arrival of that sample to the byte being written out,
+#             with the input fed in real time: what buffering costs
+# Usage: latency.sh [-q] [bytes]; -q feeds the input as fast as possible,
+# leaving out delivery. SAMPLE_RATE must match the build (8000 by default).
+set -euo pipefail
+temp=$(mktemp -d)
+here="$(dirname "$0")"
+${TRAP:-trap} "rm -rf $temp" EXIT
+
+paced=1
+if [[ ${1:-} == -q ]]
+then
+    paced=0
+    shift
+fi
+bytes=${1:-40}
+rate=${SAMPLE_RATE:-8000}
+chunk=${CHUNK:-160}  # frames fed at a time when paced
+
+# profile and extra `listen` options
+configs=(
+    "bell103"
+    "bell103 -A"
+    "bell103 -W 8"
+    "bell202"
+    "bell202 -A"
+    "v21"
+    "v21 -C 1"
+)
+modes=(direct pipelined)
+
+head -c $bytes /dev/urandom | LC_ALL=C tr -c '[:graph:]' ' ' > $temp/str
+
+# Writes the input a chunk at a time, each when its first sample is due,
+# noting when every chunk went out
+feed ()
+{
+    perl -MTime::HiRes=clock_gettime,CLOCK_MONOTONIC,sleep -e '
+        my ($paced, $rate, $chunk, $log) = @ARGV[0..3];
+        open my $in, "<", $ARGV[4] or die; binmode $in;
+        open my $times, ">", $log or die;
+        binmode STDOUT; $| = 1;
+        my $start = clock_gettime(CLOCK_MONOTONIC);
+        my $frames = 0;
+        while (read($in, my $buf, 2 * $chunk)) {
+            if ($paced) {
+                my $due = $start + $frames / $rate - clock_gettime(CLOCK_MONOTONIC);
+                sleep($due) if $due > 0;
+            }
+            my $now = clock_gettime(CLOCK_MONOTONIC);
+            print $buf;
+            $frames += length($buf) / 2;
+            printf $times "%d %.9f\n", $frames, $now;
+        }
+    ' $paced $rate $chunk "$@"
+}
+
+# Pairs the bytes that `gen` sent with those that `listen` decoded, in order,
+# and prints the distribution of each latency
+report ()
+{
+    perl -e '
+        my ($rate, $paced, $sent, $got, $fed) = @ARGV;
+        sub lines { open my $f, "<", $_[0] or die; map { [ split ] } <$f> }
+        my @sent = lines($sent);
+        my @got = lines($got);
+        my @fed = lines($fed);
+        my (@decode, @delivery);
+        my $c = 0;
+        for my $i (0 .. $#got) {
+            my ($s, $g) = ($sent[$i], $got[$i]);
+            die "byte $i differs\n" unless $s && $s->[3] == $g->[3];
+            push @decode, 1000 * ($g->[2] - $s->[2]) / $rate;
+            $c++ while $fed[$c][0] <= $g->[2];
+            push @delivery, 1000 * ($g->[4] - $fed[$c][1]);
+        }
+        die sprintf "decoded %d of %d bytes\n", scalar @got, scalar @sent unless @got == @sent;
+        sub dist {
+            my @v = sort { $a <=> $b } @_;
+            return sprintf "%8.2f %8.2f %8.2f", @v[int(0.5 * $#v), int(0.99 * $#v + 0.5), $#v];
+        }
+        printf "%s  %s\n", dist(@decode), $paced ? dist(@delivery) : "";
+    ' $rate $paced "$@"
+}
+
+printf "%-16s %-10s %26s  %s\n" "#config" "mode" "decode p50/p99/max (ms)" "$( ((paced)) && echo "delivery p50/p99/max (ms)" )"
+
+for config in "${configs[@]}"
+do
+    read profile options <<<"$config"
+    $here/../gen -M $profile $( [[ $options == *"-C 1"* ]] && echo -C 1 ) -F $temp/str -t $temp/sent > $temp/audio
+    for mode in ${modes[@]}
+    do
+        flags=(-M $profile -D 8 -P 0 $options -t $temp/got -o $temp/out)
+        [[ $mode == pipelined ]] && flags+=(-p)
+        feed $temp/fed $temp/audio | $here/../listen "${flags[@]}" 2> /dev/null
+        printf "%-16s %-10s " "$config" $mode
+        report $temp/sent $temp/got $temp/fed
+    done
+done
@@ -0,0 +1,47 @@
+#!/bin/bash
+# Checks that `ber` and its builds with other decoders (`ber-tdf2`,
+# `ber-float` and `ber-ema`) report the same thing however many threads they
+# use, and that nothing is lost over a clean channel at high SNR. Given a
+# report from an earlier run of `ber` (with default options), also shows what
+# changed.
+set -euo pipefail
+temp=$(mktemp -d)
+here="$(dirname "$0")"
+${TRAP:-trap} "rm -rf $temp" EXIT
+
+for ber in ber ber-tdf2 ber-float
+do
+    $here/../$ber -j 1 -n 2 -l 32 > $temp/serial
+    $here/../$ber -j 3 -n 2 -l 32 > $temp/threaded
+    cmp $temp/serial $temp/threaded &&
+        echo good: $ber deterministic || (echo bad: $ber reports differ: $temp ; false)
+
+    awk '$6 == "clean" && ($7 == "inf" || $7 >= 30) && $9 != 0 { print "bad: " $0 ; bad = 1 } END { exit bad }' $temp/serial &&
+        echo good: $ber clean channel
+done
+
+# The moving average smears bits too much for bell202 at 8000Hz (see
+# test-gen-decode.sh), but the 300-baud profiles come through clean.
+$here/../ber-ema -j 1 -n 2 -l 32 > $temp/serial
+$here/../ber-ema -j 3 -n 2 -l 32 > $temp/threaded
+cmp $temp/serial $temp/threaded &&
+    echo good: ber-ema deterministic || (echo bad: ber-ema reports differ: $temp ; false)
+awk '$1 != "bell202" && $6 == "clean" && ($7 == "inf" || $7 >= 30) && $9 != 0 { print "bad: " $0 ; bad = 1 } END { exit bad }' $temp/serial &&
+    echo good: ber-ema clean channel
+
+# Decimated to 5512Hz, the 300-baud profiles still come through a clean
+# channel; bell202 needs the full rate.
+$here/../ber -n 2 -l 32 -R 5512 > $temp/decimated
+awk '$1 != "bell202" && $6 == "clean" && ($7 == "inf" || $7 >= 30) && $9 != 0 { print "bad: " $0 ; bad = 1 } END { exit bad }' $temp/decimated &&
+    echo good: ber decimated clean channel
+
+# An ensemble of window sizes loses nothing over a clean channel either
+$here/../ber -n 2 -l 32 -E 6 -E 8 > $temp/ensemble
+awk '$6 == "clean" && ($7 == "inf" || $7 >= 30) && $9 != 0 { print "bad: " $0 ; bad = 1 } END { exit bad }' $temp/ensemble &&
+    echo good: ber ensemble clean channel
+
+if [[ $# -gt 0 ]]
+then
+    $here/../ber > $temp/report
+    diff -u "$1" $temp/report && echo good: unchanged || true
+fi
@@ -10,3 +10,255 @@ $here/../gen -F $temp/str |
     tee $temp/decoded |
     cmp $temp/str /dev/stdin &&
     echo good || (echo bad: $temp ; false)
+
+# The moving average smears bits too much for bell202 at 8000Hz
+for config in listen:bell103 listen:bell202 listen:v21 listen-ema:bell103 listen-ema:v21 listen-tdf2:bell103 listen-tdf2:bell202 listen-tdf2:v21 listen-float:bell103 listen-float:bell202 listen-float:v21
+do
+    IFS=: read listen profile <<<"$config"
+    for channel in 0 1
+    do
+        $here/../gen -M $profile -C $channel -F $temp/str |
+            $here/../$listen -M $profile -C $channel |
+            cmp $temp/str /dev/stdin &&
+            echo good: $listen $profile channel $channel || (echo bad: $listen $profile channel $channel: $temp ; false)
+    done
+done
+
+# Parallel encoding must match the streaming encoder exactly
+for threads in 1 3
+do
+    $here/../gen -j $threads -F $temp/str -o $temp/gen-parallel
+    cmp $temp/gen-raw $temp/gen-parallel &&
+        echo good: parallel $threads || (echo bad: parallel $threads: $temp ; false)
+done
+
+# The adaptive stage should pick up a signal far too quiet for the defaults
+for profile in bell103 bell202 v21
+do
+    $here/../gen -M $profile -G 0.02 -F $temp/str |
+        $here/../listen -M $profile -A |
+        cmp $temp/str /dev/stdin &&
+        echo good: adaptive $profile || (echo bad: adaptive $profile: $temp ; false)
+done
+
+# The squelch must not cost any bytes when a carrier follows silence
+(
+    head -c 80000 /dev/zero
+    $here/../gen -F $temp/str
+    head -c 80000 /dev/zero
+    $here/../gen -F $temp/str
+) > $temp/gen-gaps
+cat $temp/str $temp/str > $temp/str-twice
+for listen in listen listen-tdf2
+do
+    $here/../$listen -S 64 < $temp/gen-gaps |
+        cmp $temp/str-twice /dev/stdin &&
+        echo good: $listen squelch || (echo bad: $listen squelch: $temp ; false)
+done
+
+# The transposed filters keep their sums wide enough for 8-bit input, too
+$here/../gen -b 8 -F $temp/str |
+    $here/../listen-tdf2 -b 8 |
+    cmp $temp/str /dev/stdin &&
+    echo good: listen-tdf2 8-bit || (echo bad: listen-tdf2 8-bit: $temp ; false)
+
+# Lines interleaved in one input must decode as they would alone
+$here/../gen -M bell103 -C 0 -F $temp/str > $temp/line0
+$here/../gen -M bell202 -G 0.02 -F $temp/str > $temp/line1
+$here/../gen -M v21 -C 1 -F $temp/str > $temp/line2
+perl -e '
+    my @data = map { local $/; open my $f, "<", $_ or die; binmode $f; scalar <$f> } @ARGV;
+    my ($most) = sort { $b <=> $a } map { length } @data;
+    binmode STDOUT;
+    for (my $i = 0; $i < $most; $i += 2) {
+        print map { length($_) > $i ? substr($_, $i, 2) : "\0\0" } @data;
+    }
+' $temp/line{0,1,2} > $temp/lines
+$here/../listen -N 3 -o $temp/decoded%d -L 1 -M bell202 -A -L 2 -M v21 -C 1 < $temp/lines
+for line in 0 1 2
+do
+    cmp $temp/str $temp/decoded$line &&
+        echo good: line $line || (echo bad: line $line: $temp ; false)
+done
+
+# Pipelined decoding gives the same output, even through rings small enough
+# to fill and wrap constantly
+$here/../listen -N 3 -o $temp/piped%d -L 1 -M bell202 -A -L 2 -M v21 -C 1 -r 256,64 < $temp/lines 2> $temp/rings
+for line in 0 1 2
+do
+    cmp $temp/str $temp/piped$line &&
+        echo good: pipelined line $line || (echo bad: pipelined line $line: $temp ; false)
+done
+grep -q '^input ring: 256 bytes, high water' $temp/rings &&
+    echo good: ring report || (echo bad: ring report: $temp ; false)
+
+# Several listeners can decode one capture from an audio bus, each attaching
+# before the capture starts and reading it at its own pace
+bus=tynsel-test-$$
+(sleep 1 ; cat $temp/lines) | $here/../feed -B $bus -s 8000000 &
+sleep 0.2
+$here/../listen -B $bus -N 3 -o $temp/bus%d -L 1 -M bell202 -A -L 2 -M v21 -C 1 &
+$here/../listen -B $bus -N 3 -o $temp/bus-piped%d -L 1 -M bell202 -A -L 2 -M v21 -C 1 -p 2> /dev/null &
+wait
+for line in 0 1 2
+do
+    cmp $temp/str $temp/bus$line && cmp $temp/str $temp/bus-piped$line &&
+        echo good: bus line $line || (echo bad: bus line $line: $temp ; false)
+done
+
+# A listener that falls a whole bus behind says so
+(sleep 1 ; cat $temp/lines) | $here/../feed -B $bus -s 4096 &
+sleep 0.2
+$here/../listen -B $bus -N 3 -o /dev/null 2>&1 | grep -q "^bus $bus: overrun" &&
+    echo good: bus overrun || (echo bad: bus overrun: $temp ; false)
+wait
+
+# gen and listen agree on every stored sample format, whatever the width of
+# the samples inside
+for format in u8 s8 s16 s16be s24le s24be s32 s32be f32le f32be wav
+do
+    for bits in 8 16
+    do
+        $here/../gen -b $bits -f $format -F $temp/str |
+            $here/../listen -f $format -D 8 -P 0 |
+            cmp $temp/str /dev/stdin &&
+            echo good: format $format bits $bits || (echo bad: format $format bits $bits: $temp ; false)
+    done
+done
+
+# A WAV header tells listen how many lines there are
+# (each line needs an input of its own)
+cp $temp/str $temp/str1 && cp $temp/str $temp/str2
+$here/../gen -N 3 -F $temp/str -L 1 -M bell202 -F $temp/str1 -L 2 -M v21 -C 1 -F $temp/str2 -f wav -o $temp/lines.wav
+$here/../listen -f wav -F $temp/lines.wav -D 8 -P 0 -o $temp/wav%d -L 1 -M bell202 -L 2 -M v21 -C 1
+for line in 0 1 2
+do
+    cmp $temp/str $temp/wav$line &&
+        echo good: wav line $line || (echo bad: wav line $line: $temp ; false)
+done
+
+# Decoding at a reduced rate, behind a decimator, gives the same bytes
+for channel in 0 1
+do
+    $here/../gen -C $channel -F $temp/str -M v21 |
+        $here/../listen -R 5512 -C $channel -M v21 -D 8 -P 0 |
+        cmp $temp/str /dev/stdin &&
+        echo good: decimated channel $channel || (echo bad: decimated channel $channel: $temp ; false)
+done
+
+# Every byte that gen stamps is stamped again by listen, in every
+# configuration that the latency harness measures
+$here/latency.sh -q 20 > $temp/latency &&
+    echo good: latency || (echo bad: latency: $temp ; false)
+
+# gen can interleave the same lines itself
+$here/../gen -N 3 -F $temp/str -L 1 -M bell202 -G 0.02 -F $temp/str -L 2 -M v21 -C 1 -F $temp/str |
+    cmp $temp/lines /dev/stdin &&
+    echo good: gen lines || (echo bad: gen lines: $temp ; false)
+
+# Both directions of a full-duplex line can be decoded from the mix
+rev $temp/str > $temp/rev
+$here/../gen -F $temp/str -x $temp/rev > $temp/duplex
+for channel in 0 1
+do
+    expected=$([[ $channel == 0 ]] && echo $temp/str || echo $temp/rev)
+    $here/../listen -C $channel < $temp/duplex |
+        cmp $expected /dev/stdin &&
+        echo good: duplex channel $channel || (echo bad: duplex channel $channel: $temp ; false)
+done
+
+# The encoder and decoder agree in memory too, on every profile, and through
+# a mildly impaired channel
+for profile in bell103 bell202 v21
+do
+    $here/../loopback -M $profile -n 256 > $temp/loopback-$profile &&
+        echo good: loopback $profile || (echo bad: loopback $profile: $temp ; false)
+done
+$here/../loopback -n 256 -G 0.3 -O 0.1 -S 25 -K 0.002 > $temp/loopback-impaired &&
+    echo good: loopback impaired || (echo bad: loopback impaired: $temp ; false)
+
+# A recording split at any frame decodes the same as a whole, given the
+# checkpoint from the first part
+$here/../gen -F $temp/str > $temp/whole
+for frames in 1000 20001 44444
+do
+    head -c $((frames * 2)) $temp/whole | $here/../listen -D 8 -P 0 -k $temp/checkpoint > $temp/first
+    tail -c +$((frames * 2 + 1)) $temp/whole | $here/../listen -D 8 -P 0 -I $temp/checkpoint -s $frames > $temp/second
+    cat $temp/first $temp/second | cmp $temp/str /dev/stdin &&
+        echo good: split at $frames || (echo bad: split at $frames: $temp ; false)
+done
+
+# A decode resumed from its last checkpoint, after a crash left more output
+# than the checkpoint accounts for, finishes its output exactly
+head -c 60000 $temp/whole | $here/../listen -D 8 -P 0 -k $temp/last -K 8000 > /dev/null
+head -c 90000 $temp/whole | $here/../listen -D 8 -P 0 -o $temp/resumed
+$here/../listen -D 8 -P 0 -I $temp/last -o $temp/resumed < $temp/whole
+cmp $temp/str $temp/resumed &&
+    echo good: resumed || (echo bad: resumed: $temp ; false)
+
+# A checkpoint whose saved power window position (byte 58) is out of range is
+# refused rather than resumed from
+cp $temp/last $temp/corrupt
+printf '\377' | dd of=$temp/corrupt bs=1 seek=58 conv=notrunc 2> /dev/null
+! $here/../listen -D 8 -P 0 -I $temp/corrupt < $temp/whole > /dev/null 2> $temp/corrupt-err &&
+    grep -q "saved state is corrupt" $temp/corrupt-err &&
+    echo good: corrupt checkpoint refused || (echo bad: corrupt checkpoint refused: $temp ; false)
+
+# Nothing is lost when the encoder and decoder move to fresh states
+$here/../loopback -n 256 -H 1 > $temp/loopback-handoff &&
+    echo good: loopback handoff || (echo bad: loopback handoff: $temp ; false)
+
+# Decoding only where the index finds a carrier gives what decoding the
+# whole of a mostly silent archive gives, the first time and when the
+# index is reused
+rev $temp/str > $temp/rev
+$here/../gen -F $temp/str > $temp/burst0
+$here/../gen -F $temp/rev -C 1 > $temp/burst1
+{ head -c 800000 /dev/zero ; cat $temp/burst0 ; head -c 400000 /dev/zero ; cat $temp/burst1 ; head -c 200000 /dev/zero ; } > $temp/archive
+for run in first reused
+do
+    for channel in 0 1
+    do
+        expected=$([[ $channel == 0 ]] && echo $temp/str || echo $temp/rev)
+        $here/../listen -C $channel -D 8 -P 0 -F $temp/archive -x $temp/archive.idx -j 2 2> /dev/null |
+            cmp $expected /dev/stdin &&
+            echo good: indexed $run channel $channel || (echo bad: indexed $run channel $channel: $temp ; false)
+    done
+done
+grep -q "regions 2$" $temp/archive.idx &&
+    echo good: index regions || (echo bad: index regions: $temp ; false)
+
+# An index made for another layout of the same file is made again
+$here/../listen -N 2 -F $temp/archive -x $temp/archive.idx -o /dev/null 2> /dev/null
+grep -q " lines 2 " $temp/archive.idx &&
+    echo good: index remade || (echo bad: index remade: $temp ; false)
+
+# A quiet carrier on one line of many is found, though the silent lines
+# would average it away
+$here/../gen -G 0.1 -F $temp/str > $temp/faint
+{ head -c 200000 /dev/zero ; cat $temp/faint ; head -c 100000 /dev/zero ; } > $temp/faint-line
+perl -e '
+    my @data = map { local $/; open my $f, "<", $_ or die; binmode $f; scalar <$f> } @ARGV;
+    binmode STDOUT;
+    for (my $i = 0; $i < length $data[0]; $i += 2) {
+        print substr($data[0], $i, 2), "\0\0" x 7;
+    }
+' $temp/faint-line > $temp/archive8
+$here/../listen -N 8 -D 8 -P 0 -F $temp/archive8 -x $temp/archive8.idx -o $temp/decoded-faint%d 2> /dev/null
+cmp $temp/str $temp/decoded-faint0 &&
+    grep -q "regions 1$" $temp/archive8.idx &&
+    echo good: indexed interleaved || (echo bad: indexed interleaved: $temp ; false)
+
+# An ensemble that varies every stage after the filters votes for the same
+# bytes as a single decoder, and every vote yields one
+for listen in listen listen-ema listen-tdf2 listen-float
+do
+    for channel in 0 1
+    do
+        $here/../gen -C $channel -F $temp/str |
+            $here/../$listen -C $channel -D 8 -P 0 -E 6 -E 0,12,0,9 -E 0,0,6,14 -E 8 2> $temp/votes |
+            cmp $temp/str /dev/stdin &&
+            grep -q " 0 dropped$" $temp/votes &&
+            echo good: $listen ensemble channel $channel || (echo bad: $listen ensemble channel $channel: $temp ; false)
+    done
+done
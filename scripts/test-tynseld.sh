@@ -0,0 +1,34 @@
+#!/bin/bash
+# Runs many concurrent sessions of each kind through `tynseld`, which the
+# load generator checks byte for byte. `tynseld` is built only on Linux.
+set -euo pipefail
+temp=$(mktemp -d)
+here="$(dirname "$0")"
+${TRAP:-trap} "kill \$daemon 2>/dev/null || true; rm -rf $temp" EXIT
+
+if [[ ! -x $here/../tynseld ]]
+then
+    echo skipped: no tynseld
+    exit 0
+fi
+
+$here/../tynseld -s $temp/sock -j 3 &
+daemon=$!
+for try in $(seq 50)
+do
+    [[ -S $temp/sock ]] && break
+    sleep 0.1
+done
+
+for config in decode:bell103:0 encode:bell103:1 decode:bell202:0 encode:v21:0 decode:v21:1
+do
+    IFS=: read kind profile channel <<<"$config"
+    flags=()
+    [[ $kind == encode ]] && flags+=(-e)
+    $here/../tynseld-load -s $temp/sock -n 40 -l 32 -M $profile -C $channel ${flags[@]+"${flags[@]}"} > $temp/report &&
+        grep -q " $kind sessions" $temp/report &&
+        echo good: $kind $profile channel $channel || (cat $temp/report ; echo bad: $kind $profile channel $channel ; false)
+done
+
+$here/../tynseld-load -s $temp/sock -n 1 -l 1 -m | grep -q '^total sessions' &&
+    echo good: metrics || (echo bad: metrics ; false)
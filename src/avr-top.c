@@ -48,12 +48,19 @@ static SERIAL_CONFIG host_serial EEMEM __attribute__((used)) = {
     .stop_bits   = 1,
 };
 
+static MODEM_PROFILE profile EEMEM = {
+    .baud_rate   = 300,
+    .notch_width = 150, // must match NOTCH_WIDTH for coeff_table
+    .frequencies = { FREQUENCY_LIST(INIT_2D_ARRAY) },
+};
+
 static AUDIO_CONFIG audio EEMEM = {
     .channel     = CHAN_ZERO,
     .window_size = 6,
     .threshold   = 256,
     .hysteresis  = 10,
     .offset      = 12,
+    .bit_period  = BIT_PERIOD(SAMPLE_RATE, 300),
 };
 
 // These flags will be tripped by interrupt handlers
@@ -79,6 +86,7 @@ decode_fini CAT(decode_state_fini,DECODE_BITS);
 
 encode_pusher CAT(encode_bytes,ENCODE_BITS);
 sines_init CAT(init_sines,ENCODE_BITS);
+profile_init CAT(init_profile,ENCODE_BITS);
 
 static void init(BYTE_STATE *bs, DECODE_STATE **ds)
 {
@@ -89,6 +97,9 @@ static void init(BYTE_STATE *bs, DECODE_STATE **ds)
 
     init_sines(&bs->bit_state.sample_state.quadrant, 1.0 /* ignored */);
 
+    profile_init *init_profile = CAT(init_profile,ENCODE_BITS);
+    init_profile(bs, &profile);
+
     decode_init *init_decoder = CAT(decode_state_init,DECODE_BITS);
     *ds = init_decoder();
 }
@@ -104,7 +115,7 @@ _Noreturn static void run(BYTE_STATE *bs, DECODE_STATE *ds)
 
             char d = 0;
             DECODE_DATA_TYPE audio_in = (DECODE_DATA_TYPE)ADC0.RES;
-            pump_decoder(&tt_serial, &audio, &coeff_table[audio.channel], ds, &audio_in, &d);
+            pump_decoder(&tt_serial, &audio, &coeff_table[audio.channel * BIT_max], ds, &audio_in, &d);
             serial_out = d;
         }
 
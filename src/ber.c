@@ -0,0 +1,581 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+// Measures how many bytes the decoder gets wrong, for a range of decoder
+// configurations and simulated channels, by linking the encoder and decoder
+// directly. The report on stdout depends only on the options and the code
+// under test; timings (which do not) are added with `-t`.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "channel.h"
+#include "coeff.h"
+#include "decode.h"
+#include "encode.h"
+#include "profile.h"
+#include "resample.h"
+#include "sine.h"
+#include "state.h"
+#include "vote.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// samples synthesized per call to an encode_filler
+enum { BLOCK_SAMPLES = 4096 };
+
+// The decoder configurations under test; a zero window means the profile's
+// default.
+static const struct setup {
+    const char *profile;
+    enum channel channel;
+    uint8_t window_size;
+    bool adaptive;
+    uint16_t squelch;
+} setups[] = {
+    { "bell103", CHAN_ZERO, 0, false,  0 },
+    { "bell103", CHAN_ONE , 0, false,  0 },
+    { "bell103", CHAN_ZERO, 5, false,  0 },
+    { "bell103", CHAN_ZERO, 8, false,  0 },
+    { "bell103", CHAN_ZERO, 0, true ,  0 },
+    { "bell103", CHAN_ZERO, 0, false, 64 },
+    { "bell202", CHAN_ZERO, 0, false,  0 },
+    { "bell202", CHAN_ZERO, 3, false,  0 },
+    { "bell202", CHAN_ZERO, 5, false,  0 },
+    { "bell202", CHAN_ZERO, 0, true ,  0 },
+    { "bell202", CHAN_ZERO, 0, false, 64 },
+    { "v21"    , CHAN_ZERO, 0, false,  0 },
+    { "v21"    , CHAN_ONE , 0, false,  0 },
+    { "v21"    , CHAN_ZERO, 0, true ,  0 },
+};
+
+// Impairments besides noise; a frequency offset shifts every tone the
+// encoder sends.
+static const struct impairment {
+    const char *name;
+    float gain, drift, dc_offset;
+    int freq_offset;
+} impairments[] = {
+    { .name = "clean", .gain = 1.0f },
+    { .name = "quiet", .gain = 0.1f },
+    { .name = "dc"   , .gain = 1.0f, .dc_offset = 0.25f },
+    { .name = "freq+", .gain = 1.0f, .freq_offset = +20 },
+    { .name = "freq-", .gain = 1.0f, .freq_offset = -20 },
+    { .name = "drift", .gain = 1.0f, .drift = 0.005f },
+};
+
+static const float snrs[] = { INFINITY, 30, 20, 15, 10, 6 };
+
+enum {
+    SETUPS      = sizeof setups      / sizeof setups[0],
+    IMPAIRMENTS = sizeof impairments / sizeof impairments[0],
+    SNRS        = sizeof snrs        / sizeof snrs[0],
+    POINTS      = SETUPS * IMPAIRMENTS * SNRS,
+};
+
+struct options {
+    unsigned threads;
+    unsigned trials;    // per point
+    size_t length;      // bytes per trial
+    uint64_t seed;
+    bool timing;
+    unsigned long rate; // to decode at, after decimating from SAMPLE_RATE
+    unsigned members;   // in the ensemble given by -E, beyond each setup itself
+    AUDIO_CONFIG member[ENSEMBLE_MAX - 1];
+};
+
+struct result {
+    size_t sent, errors;
+    size_t samples;
+    double seconds;     // spent decoding
+};
+
+struct work {
+    const struct options *opts;
+    atomic_size_t next; // index of the next point to measure
+    struct result results[POINTS];
+};
+
+sines_fill fill_sines16;
+profile_init init_profile16;
+
+encode_pusher encode_bytes16, encode_carrier16;
+encode_filler encode_bytes_block16, encode_carrier_block16;
+
+decode_init decode_state_init16;
+decode_selector select_decoder16;
+ensemble_pumper pump_ensemble16;
+decode_fini decode_state_fini16;
+
+// gen's default framing; the decoder needs two stop bits between words
+static const SERIAL_CONFIG serial = {
+    .data_bits   = 8,
+    .parity_bits = 0,
+    .stop_bits   = 2,
+};
+
+static void *allocate(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+    if (! p) {
+        fprintf(stderr, "Failed to allocate %zu bytes\n", size);
+        exit(EXIT_FAILURE);
+    }
+
+    return p;
+}
+
+// Encodes `len` bytes between `padding` words of carrier, the way `gen`
+// does, using the block synthesizer or (if `scalar`) one sample at a time;
+// returns the number of samples written to `out`, which must be big enough.
+static size_t synthesize(const MODEM_PROFILE *p, enum channel channel, bool scalar, size_t padding, size_t len, const char data[len], int16_t *out)
+{
+    // init_sines16 would fill one table shared by every thread
+    int16_t sines[WAVE_TABLE_SIZE];
+    fill_sines16(sines, 0.5);
+    BYTE_STATE s = { .channel = channel };
+    s.bit_state.sample_state.quadrant = sines;
+    init_profile16(&s, p);
+
+    size_t done = 0;
+    for (size_t i = 0; i < 2 * padding + len; /* incremented inside loop */) {
+        const bool carrier = i < padding || i >= padding + len;
+        const char byte = carrier ? 0 : data[i - padding];
+        bool accepted = false;
+        if (scalar) {
+            if (carrier)
+                accepted = encode_carrier16(&serial, &s, true, channel, byte, &out[done++]);
+            else
+                accepted = encode_bytes16(&serial, &s, true, channel, byte, &out[done++]);
+        } else {
+            encode_filler *fill = carrier ? encode_carrier_block16 : encode_bytes_block16;
+            done += fill(&serial, &s, true, channel, byte, &accepted, BLOCK_SAMPLES, &out[done]);
+        }
+        if (accepted)
+            i++;
+    }
+
+    // drain the encoder, leaving off the sample that accepted the last word
+    for (bool accepted = false; ! accepted; /* set inside loop */) {
+        if (scalar) {
+            accepted = encode_carrier16(&serial, &s, true, channel, 0, &out[done]);
+            done += ! accepted;
+        } else {
+            done += encode_carrier_block16(&serial, &s, true, channel, 0, &accepted, BLOCK_SAMPLES, &out[done]);
+            done -= accepted;
+        }
+    }
+
+    return done;
+}
+
+// An upper bound on what synthesize() produces
+static size_t synthesis_length(const MODEM_PROFILE *p, size_t words)
+{
+    const size_t bit_count = NUM_START_BITS + serial.data_bits + serial.parity_bits + serial.stop_bits;
+    return ((words + 2) * bit_count + 1) * BIT_PERIOD(SAMPLE_RATE, p->baud_rate) / BIT_CLOCK_ONE + BLOCK_SAMPLES;
+}
+
+// The number of insertions, deletions and substitutions that turn `a` into
+// `b`, so that a lost or spurious byte counts once instead of misaligning
+// everything after it
+static size_t edit_distance(size_t na, const char a[na], size_t nb, const char b[nb])
+{
+    size_t *row = allocate((nb + 1) * sizeof *row);
+    for (size_t j = 0; j <= nb; j++)
+        row[j] = j;
+
+    for (size_t i = 1; i <= na; i++) {
+        size_t diagonal = row[0];
+        row[0] = i;
+        for (size_t j = 1; j <= nb; j++) {
+            size_t best = diagonal + (a[i - 1] != b[j - 1]);
+            if (row[j] + 1 < best)
+                best = row[j] + 1;
+            if (row[j - 1] + 1 < best)
+                best = row[j - 1] + 1;
+            diagonal = row[j];
+            row[j] = best;
+        }
+    }
+
+    size_t distance = row[nb];
+    free(row);
+    return distance;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void measure(const struct options *opts, size_t point, struct result *r)
+{
+    const struct setup *u = &setups[point / (IMPAIRMENTS * SNRS)];
+    const struct impairment *m = &impairments[point / SNRS % IMPAIRMENTS];
+    const float snr = snrs[point % SNRS];
+
+    const MODEM_PROFILE *profile = find_profile(u->profile);
+    MODEM_PROFILE shifted = *profile;
+    for (int c = 0; c < CHAN_max; c++)
+        for (int b = 0; b < BIT_max; b++)
+            shifted.frequencies[c][b] = (uint16_t)(shifted.frequencies[c][b] + m->freq_offset);
+
+    const long rate = (long)opts->rate;
+    AUDIO_CONFIG audio = profile_audio(profile, u->channel, rate);
+    if (u->window_size)
+        audio.window_size = u->window_size;
+    audio.adaptive = u->adaptive;
+    audio.squelch = u->squelch;
+
+    // An ensemble's members take what -E left out from the setup
+    ENSEMBLE_CONFIG ensemble = { .members = (uint8_t)(opts->members ? opts->members + 1 : 0) };
+    ensemble.audio[0] = audio;
+    for (unsigned m = 0; m < opts->members; m++) {
+        const AUDIO_CONFIG *given = &opts->member[m];
+        AUDIO_CONFIG *member = &ensemble.audio[m + 1];
+        *member = audio;
+        if (given->window_size)
+            member->window_size = given->window_size;
+        if (given->threshold)
+            member->threshold = given->threshold;
+        if (given->hysteresis)
+            member->hysteresis = given->hysteresis;
+        if (given->offset)
+            member->offset = given->offset;
+    }
+    const unsigned word = NUM_START_BITS + serial.data_bits + serial.parity_bits + serial.stop_bits;
+    const uint64_t vote_window = (uint64_t)word * audio.bit_period / BIT_CLOCK_ONE / 2;
+
+    struct filter_config coeffs[CHAN_max * BIT_max];
+    design_notches(coeffs, profile, (unsigned long)rate);
+    decode_pumper *pump = select_decoder16(&serial, &audio);
+
+    // a quarter-second of carrier on each end
+    const size_t padding = profile->baud_rate / 4 / (NUM_START_BITS + serial.data_bits + serial.parity_bits + serial.stop_bits);
+    const size_t len = opts->length;
+
+    char *sent = allocate(len);
+    char *received = allocate(2 * len + 16);
+    int16_t *clean = allocate(synthesis_length(profile, 2 * padding + len) * sizeof *clean);
+
+    *r = (struct result){ 0 };
+    for (unsigned trial = 0; trial < opts->trials; trial++) {
+        uint64_t state = opts->seed ^ ((uint64_t)point << 32 | trial);
+        channel_random(&state); // decorrelate neighbouring seeds
+        for (size_t i = 0; i < len; i++)
+            sent[i] = (char)channel_random(&state);
+
+        const size_t count = synthesize(&shifted, u->channel, false, padding, len, sent, clean);
+
+        const CHANNEL_CONFIG channel = {
+            .gain      = m->gain,
+            .drift     = m->drift,
+            .dc_offset = m->dc_offset,
+            .snr       = snr,
+            .seed      = channel_random(&state),
+        };
+        int16_t *noisy = allocate(channel_length(&channel, count) * sizeof *noisy);
+        const size_t samples = channel_apply(&channel, count, clean, noisy);
+
+        // Decimation is timed along with decoding, since it is part of the
+        // cost of decoding at a reduced rate.
+        struct resampler resampler;
+        int16_t *decimated = NULL;
+        if (rate != SAMPLE_RATE) {
+            if (resampler_init(&resampler, SAMPLE_RATE, (unsigned long)rate)) {
+                perror("Failed to design resampler");
+                exit(EXIT_FAILURE);
+            }
+            decimated = allocate(resample_length(&resampler, samples) * sizeof *decimated);
+        }
+
+        DECODE_STATE *ds = decode_state_init16();
+        DECODE_STATE *members[ENSEMBLE_MAX] = { ds };
+        for (unsigned m = 1; m < ensemble.members; m++)
+            members[m] = decode_state_init16();
+        struct vote vote;
+        vote_init(&vote, ensemble.members, vote_window);
+        size_t got = 0;
+        const double start = now();
+        int16_t *decoding = noisy;
+        size_t decode_count = samples;
+        if (decimated) {
+            decode_count = resample(&resampler, samples, noisy, decimated);
+            decoding = decimated;
+        }
+        if (ensemble.members) {
+            char decided[ENSEMBLE_MAX + 1];
+            for (size_t i = 0; i < decode_count; i++) {
+                char ballot[ENSEMBLE_MAX];
+                const unsigned cast = pump_ensemble16(&serial, &ensemble, &coeffs[audio.channel * BIT_max], members, &decoding[i], ballot);
+                if (! cast && ! vote.cast)
+                    continue;
+                const size_t n = vote_cast(&vote, i, cast, ballot, decided);
+                for (size_t k = 0; k < n && got < 2 * len + 16; k++)
+                    received[got++] = decided[k];
+            }
+            if (vote_flush(&vote, decided) && got < 2 * len + 16)
+                received[got++] = decided[0];
+        } else {
+            for (size_t i = 0; i < decode_count; i++) {
+                char out = 0;
+                if (pump(&serial, &audio, &coeffs[audio.channel * BIT_max], ds, &decoding[i], &out) && got < 2 * len + 16)
+                    received[got++] = out;
+            }
+        }
+        r->seconds += now() - start;
+        for (unsigned m = 1; m < ensemble.members; m++)
+            decode_state_fini16(members[m]);
+        decode_state_fini16(ds);
+        if (decimated) {
+            free(decimated);
+            resampler_fini(&resampler);
+        }
+
+        r->sent += len;
+        r->errors += edit_distance(len, sent, got, received);
+        r->samples += samples;
+        free(noisy);
+    }
+
+    free(clean);
+    free(received);
+    free(sent);
+}
+
+static void *worker(void *arg)
+{
+    struct work *w = arg;
+    size_t point;
+    while ((point = atomic_fetch_add(&w->next, 1)) < POINTS)
+        measure(w->opts, point, &w->results[point]);
+
+    return NULL;
+}
+
+// The block synthesizer must match the sample-at-a-time one exactly.
+static bool check_synthesis(const struct options *opts)
+{
+    bool ok = true;
+    const size_t len = opts->length;
+    char *data = allocate(len);
+    uint64_t state = opts->seed;
+    for (size_t i = 0; i < len; i++)
+        data[i] = (char)channel_random(&state);
+
+    for (size_t i = 0; i < SETUPS; i++) {
+        const MODEM_PROFILE *p = find_profile(setups[i].profile);
+        const size_t bound = synthesis_length(p, 2 + len);
+        int16_t *a = allocate(bound * sizeof *a);
+        int16_t *b = allocate(bound * sizeof *b);
+        const size_t na = synthesize(p, setups[i].channel, false, 1, len, data, a);
+        const size_t nb = synthesize(p, setups[i].channel, true , 1, len, data, b);
+        if (na != nb || memcmp(a, b, na * sizeof *a) != 0) {
+            fprintf(stderr, "Block synthesis differs from scalar for %s channel %d\n", setups[i].profile, setups[i].channel);
+            ok = false;
+        }
+        free(b);
+        free(a);
+    }
+
+    free(data);
+    return ok;
+}
+
+#if defined(USE_FILTER_TDF2) && ! defined(USE_FLOATING_POINT)
+// The sums in the filters must fit their accumulators for every setup.
+static bool check_headroom(const struct options *opts)
+{
+    bool ok = true;
+    for (size_t i = 0; i < SETUPS; i++) {
+        struct filter_config coeffs[CHAN_max * BIT_max];
+        design_notches(coeffs, find_profile(setups[i].profile), opts->rate);
+        const double peak = notches_peak(coeffs);
+        if (peak >= FILTER_SUM_LIMIT) {
+            fprintf(stderr, "Filters for %s could overflow at %lu Hz (peak %.2f)\n", setups[i].profile, opts->rate, peak);
+            ok = false;
+        }
+    }
+    return ok;
+}
+#endif
+
+// Adds a member to the ensemble from -E window,threshold,hysteresis,offset,
+// where numbers left out or zero are each setup's own.
+static int add_member(struct options *o, const char *s)
+{
+    long v[4] = { 0 };
+    unsigned n = 0;
+    char *end = NULL;
+    do {
+        if (n == 4)
+            return -1;
+        v[n++] = strtol(s, &end, 0);
+        if (end == s || (*end != ',' && *end != '\0'))
+            return -1;
+        s = end + 1;
+    } while (*end == ',');
+
+    if (o->members == ENSEMBLE_MAX - 1 || v[0] < 0 || v[0] > MAX_RMS_SAMPLES)
+        return -1;
+
+    o->member[o->members++] = (AUDIO_CONFIG){
+        .window_size = (uint8_t)v[0],
+        .threshold   = (RMS_OUT_DATA)v[1],
+        .hysteresis  = (int8_t)v[2],
+        .offset      = (int8_t)v[3],
+    };
+
+    return 0;
+}
+
+static int parse_opts(struct options *o, int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "j:n:l:s:tR:E:")) != -1) {
+        switch (ch) {
+            case 'j': o->threads = strtoul (optarg, NULL, 0);   break;
+            case 'n': o->trials  = strtoul (optarg, NULL, 0);   break;
+            case 'l': o->length  = strtoul (optarg, NULL, 0);   break;
+            case 's': o->seed    = strtoull(optarg, NULL, 0);   break;
+            case 't': o->timing  = true;                        break;
+            case 'R': o->rate    = strtoul (optarg, NULL, 0);   break;
+            case 'E':
+                if (add_member(o, optarg)) {
+                    fprintf(stderr, "Expected up to %d -E window[,threshold[,hysteresis[,offset]]]\n", ENSEMBLE_MAX - 1);
+                    return -1;
+                }
+                break;
+
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    struct options opts = {
+        .threads = cores > 0 ? (unsigned)cores : 1,
+        .trials  = 4,
+        .length  = 64,
+        .seed    = 1,
+    };
+
+    if (parse_opts(&opts, argc, argv))
+        exit(EXIT_FAILURE);
+
+    if (opts.threads < 1)
+        opts.threads = 1;
+
+    if (! opts.rate)
+        opts.rate = SAMPLE_RATE;
+
+    if (opts.rate > SAMPLE_RATE) {
+        fprintf(stderr, "Decoding rate must be at most %d Hz\n", SAMPLE_RATE);
+        exit(EXIT_FAILURE);
+    }
+
+    if (! check_synthesis(&opts))
+        exit(EXIT_FAILURE);
+
+#if defined(USE_FILTER_TDF2) && ! defined(USE_FLOATING_POINT)
+    if (! check_headroom(&opts))
+        exit(EXIT_FAILURE);
+#endif
+
+    static struct work work;
+    work.opts = &opts;
+    atomic_init(&work.next, 0);
+
+    pthread_t threads[opts.threads];
+    for (unsigned t = 1; t < opts.threads; t++) {
+        int rc = pthread_create(&threads[t], NULL, worker, &work);
+        if (rc) {
+            fprintf(stderr, "Failed to start thread : %s\n", strerror(rc));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    worker(&work);
+
+    for (unsigned t = 1; t < opts.threads; t++)
+        pthread_join(threads[t], NULL);
+
+    printf("# %u trials of %zu bytes per point, seed %llu, sample rate %d",
+            opts.trials, opts.length, (unsigned long long)opts.seed, SAMPLE_RATE);
+    if (opts.rate != SAMPLE_RATE)
+        printf(", decoded at %lu", opts.rate);
+    if (opts.members)
+        printf(", ensemble of %u", opts.members + 1);
+    putchar('\n');
+#if defined(USE_FLOATING_POINT)
+    printf("# floating-point decoder\n");
+#endif
+#if defined(USE_POWER_EMA)
+    printf("# moving-average power estimate\n");
+#endif
+#if defined(USE_FILTER_TDF2)
+    printf("# transposed direct form II filters\n");
+#endif
+    printf("%-8s %-4s %-6s %-5s %-7s %-7s %-4s %8s %8s %10s%s\n",
+            "#profile", "chan", "window", "adapt", "squelch", "impair", "snr", "bytes", "errors", "rate",
+            opts.timing ? "     Msps" : "");
+
+    size_t sent = 0, errors = 0;
+    for (size_t point = 0; point < POINTS; point++) {
+        const struct setup *u = &setups[point / (IMPAIRMENTS * SNRS)];
+        const struct impairment *m = &impairments[point / SNRS % IMPAIRMENTS];
+        const struct result *r = &work.results[point];
+        const MODEM_PROFILE *p = find_profile(u->profile);
+        const int window = u->window_size ? u->window_size : scale_profile_value_at(p->window_size, (long)opts.rate);
+
+        printf("%-8s %-4d %-6d %-5d %-7d %-7s %-4.0f %8zu %8zu %10.6f",
+                u->profile, u->channel, window, u->adaptive, u->squelch, m->name, snrs[point % SNRS],
+                r->sent, r->errors, (double)r->errors / r->sent);
+        if (opts.timing)
+            printf(" %8.2f", r->samples / r->seconds * 1e-6);
+        putchar('\n');
+
+        sent += r->sent;
+        errors += r->errors;
+    }
+
+    printf("# total %zu bytes, %zu errors, rate %.6f\n", sent, errors, (double)errors / sent);
+
+    return 0;
+}
+
@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#if defined(__linux__)
+#define _GNU_SOURCE // for syscall
+#endif
+
+#include "bus.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#define BUS_MAGIC 0x7475736eu // "nsut"
+enum { BUS_VERSION = 1 };
+
+struct bus_shared {
+    _Atomic uint32_t magic;     // written last, once the rest is ready
+    uint32_t version;
+    uint64_t size;              // bytes of data, a power of two
+
+    // written only by the writer
+    alignas(64) _Atomic uint64_t head;  // bytes ever written
+    _Atomic uint64_t reserved;          // `head` plus bytes being written
+    _Atomic uint32_t seq;               // changes with every publication
+    _Atomic uint32_t closed;
+
+    // written by readers
+    alignas(64) _Atomic uint32_t waiters;
+
+    alignas(64) char data[];
+};
+
+// The first byte of data that a write in progress may overwrite
+static uint64_t oldest(const struct bus_shared *s, uint64_t reserved)
+{
+    return reserved > s->size ? reserved - s->size : 0;
+}
+
+static uint64_t round_up(uint64_t n, size_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+static void wait_for(_Atomic uint32_t *word, uint32_t seen)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, seen, NULL, NULL, 0);
+#else
+    static const struct timespec nap = { .tv_nsec = 1000000 };
+    (void)word;
+    (void)seen;
+    nanosleep(&nap, NULL);
+#endif
+}
+
+static void wake_all(_Atomic uint32_t *word)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
+// Makes a POSIX shared memory object name out of `name`
+static const char *shm_name(const char *name, char buf[], size_t len)
+{
+    if (name[0] == '/')
+        return name;
+    snprintf(buf, len, "/%s", name);
+    return buf;
+}
+
+int bus_create(struct bus *b, const char *name, size_t size)
+{
+    size_t rounded = 4096;
+    while (rounded < size)
+        rounded *= 2;
+
+    char buf[NAME_MAX];
+    name = shm_name(name, buf, sizeof buf);
+    shm_unlink(name);
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return -1;
+
+    const size_t mapped = sizeof(struct bus_shared) + rounded;
+    void *where = MAP_FAILED;
+    if (ftruncate(fd, (off_t)mapped) == 0)
+        where = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int saved = errno;
+    close(fd);
+    if (where == MAP_FAILED) {
+        shm_unlink(name);
+        errno = saved;
+        return -1;
+    }
+
+    *b = (struct bus){ .shared = where, .mapped = mapped };
+    b->shared->version = BUS_VERSION;
+    b->shared->size = rounded;
+    atomic_store_explicit(&b->shared->magic, BUS_MAGIC, memory_order_release);
+    return 0;
+}
+
+static void publish(struct bus_shared *s, const char *from, size_t count)
+{
+    const uint64_t head = atomic_load_explicit(&s->head, memory_order_relaxed);
+
+    // Readers check `reserved` after copying, to tell whether what they
+    // copied was being overwritten meanwhile.
+    atomic_store_explicit(&s->reserved, head + count, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    const size_t offset = head & (s->size - 1);
+    const size_t first = s->size - offset < count ? s->size - offset : count;
+    memcpy(s->data + offset, from, first);
+    memcpy(s->data, from + first, count - first);
+
+    atomic_store_explicit(&s->head, head + count, memory_order_release);
+    atomic_fetch_add_explicit(&s->seq, 1, memory_order_release);
+    if (atomic_load_explicit(&s->waiters, memory_order_seq_cst))
+        wake_all(&s->seq);
+}
+
+void bus_write(struct bus *b, const void *data, size_t count)
+{
+    // A reader can keep up with writes of at most half a ring at a time.
+    const size_t most = b->shared->size / 2;
+    const char *from = data;
+    while (count > 0) {
+        const size_t n = count < most ? count : most;
+        publish(b->shared, from, n);
+        from += n;
+        count -= n;
+    }
+}
+
+void bus_close(struct bus *b)
+{
+    struct bus_shared *s = b->shared;
+    atomic_store_explicit(&s->closed, 1, memory_order_release);
+    atomic_fetch_add_explicit(&s->seq, 1, memory_order_release);
+    wake_all(&s->seq);
+}
+
+int bus_unlink(const char *name)
+{
+    char buf[NAME_MAX];
+    return shm_unlink(shm_name(name, buf, sizeof buf));
+}
+
+int bus_attach(struct bus *b, const char *name, size_t align)
+{
+    char buf[NAME_MAX];
+    const int fd = shm_open(shm_name(name, buf, sizeof buf), O_RDWR, 0);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    void *where = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > sizeof(struct bus_shared))
+        where = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    else
+        errno = EINVAL;
+    const int saved = errno;
+    close(fd);
+    if (where == MAP_FAILED) {
+        errno = saved;
+        return -1;
+    }
+
+    struct bus_shared *s = where;
+    if (atomic_load_explicit(&s->magic, memory_order_acquire) != BUS_MAGIC || s->version != BUS_VERSION
+            || sizeof *s + s->size > (size_t)st.st_size) {
+        munmap(where, (size_t)st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    *b = (struct bus){ .shared = s, .mapped = (size_t)st.st_size, .align = align ? align : 1 };
+    b->tail = round_up(oldest(s, atomic_load_explicit(&s->reserved, memory_order_acquire)), b->align);
+    return 0;
+}
+
+size_t bus_read(struct bus *b, void *data, size_t max)
+{
+    struct bus_shared *s = b->shared;
+    max -= max % b->align;
+
+    while (true) {
+        uint64_t head = atomic_load_explicit(&s->head, memory_order_acquire);
+        // Wait for a whole frame; a partial one at the end is dropped.
+        while (head < b->tail + b->align) {
+            const uint32_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+            const uint32_t closed = atomic_load_explicit(&s->closed, memory_order_acquire);
+            head = atomic_load_explicit(&s->head, memory_order_acquire);
+            if (head >= b->tail + b->align)
+                break;
+            if (closed)
+                return 0;
+
+            atomic_fetch_add_explicit(&s->waiters, 1, memory_order_seq_cst);
+            wait_for(&s->seq, seq);
+            atomic_fetch_sub_explicit(&s->waiters, 1, memory_order_relaxed);
+            head = atomic_load_explicit(&s->head, memory_order_acquire);
+        }
+
+        size_t n = head - b->tail < max ? (size_t)(head - b->tail) : max;
+        n -= n % b->align;
+
+        const size_t offset = b->tail & (s->size - 1);
+        const size_t first = s->size - offset < n ? s->size - offset : n;
+        memcpy(data, s->data + offset, first);
+        memcpy((char*)data + first, s->data, n - first);
+
+        // If the writer has since come within a ring of where we read from,
+        // what we copied may be a mixture of old and new data.
+        atomic_thread_fence(memory_order_acquire);
+        const uint64_t lost = oldest(s, atomic_load_explicit(&s->reserved, memory_order_relaxed));
+        if (lost > b->tail) {
+            const uint64_t resume = round_up(lost, b->align);
+            b->overruns++;
+            b->lost += resume - b->tail;
+            b->tail = resume;
+            continue;
+        }
+
+        b->tail += n;
+        return n;
+    }
+}
+
+void bus_detach(struct bus *b)
+{
+    munmap(b->shared, b->mapped);
+    b->shared = NULL;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef BUS_H_
+#define BUS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// An audio bus carries one capture to any number of readers through a ring
+// in POSIX shared memory, so that the capture is written once however many
+// decoders consume it. The writer never waits for readers: each reader keeps
+// its own position, and one that falls more than a ring behind the writer
+// has been overrun, and skips ahead past what it lost. Readers waiting for
+// data sleep on a futex (on Linux; elsewhere they poll).
+
+struct bus_shared;
+
+struct bus {
+    struct bus_shared *shared;
+    size_t mapped;              // bytes of shared memory mapped
+    uint64_t tail;              // for a reader, bytes read or skipped
+    size_t align;               // a reader's positions are multiples of this
+    unsigned long overruns;     // times a reader was overrun
+    uint64_t lost;              // bytes skipped on that account
+};
+
+// Replaces any bus called `name` with a new one of at least `size` bytes
+// (rounded up to a power of two) for the caller to write. Returns nonzero,
+// with errno set, on failure.
+int bus_create(struct bus *b, const char *name, size_t size);
+
+// Writes `count` bytes to every reader.
+void bus_write(struct bus *b, const void *data, size_t count);
+
+// Marks the end of the capture, waking readers waiting for more.
+void bus_close(struct bus *b);
+
+// Removes the name of a bus; readers already attached keep reading.
+int bus_unlink(const char *name);
+
+// Attaches to the bus called `name`, starting at the oldest data that it
+// still holds, reading in multiples of `align` bytes (the size of a frame of
+// samples). Returns nonzero, with errno set, on failure.
+int bus_attach(struct bus *b, const char *name, size_t align);
+
+// Waits for data, then reads up to `max` bytes into `data`. Returns zero only
+// at the end of the capture.
+size_t bus_read(struct bus *b, void *data, size_t max);
+
+void bus_detach(struct bus *b);
+
+#endif
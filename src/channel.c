@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "channel.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+uint64_t channel_random(uint64_t *state)
+{
+    // splitmix64
+    uint64_t z = (*state += 0x9e3779b97f4a7c15u);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    return z ^ (z >> 31);
+}
+
+// Approximately normal, with unit variance, from the sum of twelve uniform
+// variates. Unlike Box-Muller, this needs no transcendental functions, whose
+// results can differ in the last place from one C library to the next.
+static float gaussian(uint64_t *state)
+{
+    float sum = 0;
+    for (int i = 0; i < 12; i++)
+        sum += (float)(channel_random(state) >> 40) * 0x1p-24f;
+
+    return sum - 6;
+}
+
+// Applies gain, DC offset and noise to one sample
+static int16_t impair(const CHANNEL_CONFIG *c, float sd, uint64_t *state, float x)
+{
+    x = x * c->gain + c->dc_offset * INT16_MAX;
+    if (sd > 0)
+        x += sd * gaussian(state);
+
+    x = roundf(x);
+    return (int16_t)(x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : x);
+}
+
+// The standard deviation of the noise for a signal of mean power `power`
+// (before gain)
+static float noise_sd(const CHANNEL_CONFIG *c, double power)
+{
+    power *= (double)c->gain * c->gain;
+    return isinf(c->snr) ? 0 : (float)sqrt(power / pow(10, c->snr / 10));
+}
+
+static double mean_power(size_t count, const int16_t in[count])
+{
+    double power = 0;
+    for (size_t i = 0; i < count; i++)
+        power += (double)in[i] * in[i];
+
+    return power / (count ? count : 1);
+}
+
+size_t channel_length(const CHANNEL_CONFIG *c, size_t count)
+{
+    return count ? (size_t)((double)(count - 1) * (1 + (double)c->drift)) + 1 : 0;
+}
+
+size_t channel_apply(const CHANNEL_CONFIG *c, size_t count, const int16_t in[count], int16_t *out)
+{
+    const float sd = noise_sd(c, mean_power(count, in));
+
+    uint64_t state = c->seed;
+    const size_t length = channel_length(c, count);
+    for (size_t k = 0; k < length; k++) {
+        // The receiver takes its k-th sample at this point in the input
+        const double where = k / (1 + (double)c->drift);
+        const size_t i = (size_t)where;
+        const float frac = (float)(where - i);
+
+        float x = in[i];
+        if (frac > 0 && i + 1 < count)
+            x += frac * (in[i + 1] - in[i]);
+
+        out[k] = impair(c, sd, &state, x);
+    }
+
+    return length;
+}
+
+void channel_stream_init(CHANNEL_STREAM *s, const CHANNEL_CONFIG *c)
+{
+    *s = (CHANNEL_STREAM){ .config = *c, .state = c->seed, .sd = -1 };
+}
+
+size_t channel_stream_length(const CHANNEL_STREAM *s, size_t count)
+{
+    return (size_t)((double)count / (1 + (double)s->config.drift)) + 2;
+}
+
+size_t channel_stream(CHANNEL_STREAM *s, size_t count, const int16_t in[count], int16_t *out)
+{
+    const CHANNEL_CONFIG *c = &s->config;
+    if (s->sd < 0) {
+        const double power = mean_power(count, in);
+        if (power > 0)
+            s->sd = noise_sd(c, power);
+    }
+    const float sd = s->sd > 0 ? s->sd : 0;
+
+    // Positions are counted from the start of the stream; position
+    // `consumed - 1` is the previous block's last sample.
+    size_t made = 0;
+    while (true) {
+        const double where = s->produced / (1 + (double)c->drift);
+        const uint64_t i = (uint64_t)where;
+        const float frac = (float)(where - i);
+        if (i + (frac > 0) >= s->consumed + count)
+            break;
+
+        const float x0 = i < s->consumed ? s->previous : in[i - s->consumed];
+        float x = x0;
+        if (frac > 0)
+            x += frac * (in[i + 1 - s->consumed] - x0);
+
+        out[made++] = impair(c, sd, &s->state, x);
+        s->produced++;
+    }
+
+    if (count) {
+        s->previous = in[count - 1];
+        s->consumed += count;
+    }
+
+    return made;
+}
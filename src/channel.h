@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef CHANNEL_H_
+#define CHANNEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Impairments applied to a stream of 16-bit samples on its way from an
+// encoder to a decoder, in this order: gain, receiver clock drift, DC offset,
+// noise.
+typedef struct {
+    float    gain;      // scales the signal
+    float    drift;     // relative error of the receiver's sample clock
+    float    dc_offset; // as a fraction of full scale
+    float    snr;       // in dB, relative to the scaled signal; INFINITY for none
+    uint64_t seed;      // for the noise
+} CHANNEL_CONFIG;
+
+// Returns the next number from a seeded pseudo-random sequence.
+uint64_t channel_random(uint64_t *state);
+
+// Returns how many samples channel_apply() makes from `count` samples.
+size_t channel_length(const CHANNEL_CONFIG *c, size_t count);
+
+// Writes the impaired form of `in` to `out`, which must have room for
+// channel_length() samples; returns the number written. The same
+// configuration and input always give the same output.
+size_t channel_apply(const CHANNEL_CONFIG *c, size_t count, const int16_t in[count], int16_t *out);
+
+// The same impairments, applied to an unbounded stream a block at a time.
+// The noise level is set by the power of the first block with any signal.
+typedef struct {
+    CHANNEL_CONFIG config;
+    float sd;           // of the noise, once it is known
+    uint64_t state;     // for the noise
+    uint64_t consumed;  // input samples before the current block
+    uint64_t produced;  // output samples so far
+    int16_t previous;   // the last input sample of the previous block
+} CHANNEL_STREAM;
+
+void channel_stream_init(CHANNEL_STREAM *s, const CHANNEL_CONFIG *c);
+
+// Returns the most samples that channel_stream() makes from `count` samples.
+size_t channel_stream_length(const CHANNEL_STREAM *s, size_t count);
+
+// Writes the impaired form of the next `count` samples of the stream to
+// `out`, which must have room for channel_stream_length() samples; returns
+// the number written. Samples that fall after the last input are made from
+// the next block.
+size_t channel_stream(CHANNEL_STREAM *s, size_t count, const int16_t in[count], int16_t *out);
+
+#endif
+
@@ -45,7 +45,21 @@ struct filter_config {
 #define coeff_a1 coeff_b1
 };
 
+// Indexed by [channel * BIT_max + bit], for the Bell 103 frequencies only.
 extern const struct filter_config coeff_table[];
 
+// Fills `table` like coeff_table, for any tone plan and sample rate.
+void design_notches(struct filter_config table[CHAN_max * BIT_max], const MODEM_PROFILE *p, unsigned long sample_rate);
+
+// A fixed-point filter sums products of its 16-bit input and output with
+// coefficients that carry COEFF_FRACTIONAL_BITS in an int32_t, which leaves
+// room for sums up to this multiple of the largest input magnitude.
+#define FILTER_SUM_LIMIT (1L << (31 - 15 - COEFF_FRACTIONAL_BITS))
+
+// Bounds, for any input, every sum that the transposed direct form II engine
+// (see filter() in decode.c) forms while running the filters in `table`, as a
+// multiple of the largest input magnitude.
+double notches_peak(const struct filter_config table[CHAN_max * BIT_max]);
+
 #endif
 
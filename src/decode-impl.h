@@ -26,48 +26,121 @@
 #include "coeff.h"
 #include "decode.h"
 
+#include <limits.h>
+
 #define THRESHOLD 0
-#define MAX_RMS_SAMPLES 8
 
+// Each transition seen inside a word moves the bit clock 1/2^N of the way
+// toward the phase that the transition implies.
+#define BIT_CLOCK_PLL_SHIFT 1
+
+// The adaptive stage (see AUDIO_CONFIG) keeps the RMS amplitude of the
+// stronger tone, as seen by power(), between about 2^LEVEL_LOW_SHIFT and
+// 2^LEVEL_HIGH_SHIFT. The noise floor follows the weaker tone's power,
+// falling with a time constant of 2^FLOOR_FALL_SHIFT samples and rising with
+// one of 2^FLOOR_RISE_SHIFT, and the gate opens at 2^GATE_SHIFT times the
+// floor (but never below AUDIO_CONFIG.threshold).
+#define LEVEL_LOW_SHIFT  4
+#define LEVEL_HIGH_SHIFT 6
+#define LEVEL_HOLD       255 // samples between increases in gain
+#define FLOOR_FALL_SHIFT 4
+#define FLOOR_RISE_SHIFT 8
+#define GATE_SHIFT       0
+
+// The squelch's peak detector decays with a time constant of
+// 2^SQUELCH_DECAY_SHIFT samples, which is also about how long the squelch
+// holds open once the carrier drops below AUDIO_CONFIG.squelch.
+#define SQUELCH_DECAY_SHIFT 6
+
+#if defined(USE_FLOATING_POINT)
+// Floating-point filters work in the units of their input, so only the type
+// changes.
+#define EXPAND(X,Y) ((Y)(X))
+#define SHRINK(X,Y) ((Y)(X))
+#else
 #define EXPAND(X,Y) (assert(sizeof(Y) >= sizeof(X)), (X) << (CHAR_BIT * (sizeof(Y) - sizeof(X))))
 #define SHRINK(X,Y) (assert(sizeof(X) >= sizeof(Y)), (X) >> (CHAR_BIT * (sizeof(X) - sizeof(Y))))
+#endif
+
+// power() works in the units of an int8_t input, whatever DECODE_BITS is,
+// so that thresholds mean the same thing for every build.
+#define NARROW_SHIFT (CHAR_BIT * (sizeof(DECODE_DATA_TYPE) - sizeof(int8_t)))
 
 typedef DECODE_DATA_TYPE FILTER_IN_DATA;
-typedef FILTER_IN_DATA FILTER_OUT_DATA;
 
+#if defined(USE_FLOATING_POINT)
+typedef float FILTER_OUT_DATA;
+typedef float RMS_IN_DATA;
+#else
+typedef FILTER_IN_DATA FILTER_OUT_DATA;
 typedef int8_t RMS_IN_DATA;
+#endif
 typedef int8_t RUNS_OUT_DATA;
 
+// With USE_FILTER_TDF2, each filter keeps two sums of products instead of
+// histories of its input and output (see filter() in decode.c). In fixed
+// point, the sums keep every fractional bit of the coefficients.
+#if defined(USE_FLOATING_POINT)
+typedef float FILTER_SUM_DATA;
+#else
+typedef int32_t FILTER_SUM_DATA;
+#endif
+
 typedef RMS_OUT_DATA RUNS_IN_DATA;
 typedef RUNS_OUT_DATA DECODE_IN_DATA;
 
 struct bits_state {
-    int8_t off;
+    int16_t off; // in units of 1/BIT_CLOCK_ONE samples; negative when idle
     int8_t last;
     uint8_t bit;
     char byte;
 };
 
 struct power_state {
+#if defined(USE_POWER_EMA)
+    RMS_OUT_DATA sum; // exponentially weighted, so no window is kept
+    uint8_t count; // samples seen, until primed
+#else
     RMS_OUT_DATA window[MAX_RMS_SAMPLES];
     RMS_OUT_DATA sum;
     uint8_t ptr;
+#endif
     bool primed;
 };
 
+struct level_state {
+    RMS_OUT_DATA peak;  // the stronger tone's power, decaying slowly
+    RMS_OUT_DATA floor; // the weaker tone's power, smoothed
+    uint8_t gain;       // power() sees filter outputs amplified by 2^gain
+    uint8_t hold;       // samples until the gain may change again
+};
+
+struct squelch_state {
+    uint16_t peak; // input amplitude, decaying
+    bool closed;
+};
+
 struct runs_state {
     RUNS_OUT_DATA current;
 };
 
+#if defined(USE_FILTER_TDF2)
+struct filter_state {
+    FILTER_SUM_DATA sum[2];
+};
+#else
 struct filter_state {
     FILTER_IN_DATA in[3];
     FILTER_STATE_DATA out[3];
     uint8_t ptr;
 };
+#endif
 
 struct decode_state {
     struct power_state power[2];
     struct filter_state filt[2];
+    struct level_state level;
+    struct squelch_state squelch;
     struct runs_state run;
     struct bits_state dec;
 };
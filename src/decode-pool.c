@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "decode-impl.h"
+#include "pool.h"
+
+// The most decoder states in use at once
+#if ! defined(DECODE_POOL_SIZE)
+#define DECODE_POOL_SIZE 4096
+#endif
+
+static struct { alignas(POOL_ALIGN) DECODE_STATE state; } states[DECODE_POOL_SIZE];
+static _Atomic uint32_t links[DECODE_POOL_SIZE];
+static struct pool pool = POOL_INITIALIZER(states, links);
+
+// Returns NULL when DECODE_POOL_SIZE states are already in use.
+DECODE_STATE *CAT(decode_state_init,DECODE_BITS)()
+{
+    DECODE_STATE *state = pool_get(&pool);
+    if (state) {
+        *state = (DECODE_STATE){
+            .dec = { .off = -1, .last = THRESHOLD },
+        };
+    }
+
+    return state;
+}
+
+void CAT(decode_state_fini,DECODE_BITS)(DECODE_STATE *s)
+{
+    if (s)
+        pool_put(&pool, s);
+}
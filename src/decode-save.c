@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "decode-impl.h"
+#include "save.h"
+
+// Every field of the state is saved, in the order declared in
+// decode-impl.h, except that a power window is saved whole even when the
+// window in use is shorter.
+
+#if defined(USE_FILTER_TDF2)
+#define FILTER_FLAGS SAVE_TDF2
+#else
+#define FILTER_FLAGS 0
+#endif
+
+static const struct save_header header = {
+    .kind   = SAVE_DECODER,
+    .bits   = DECODE_BITS,
+#if defined(USE_FLOATING_POINT)
+    .flags  = SAVE_FLOAT | FILTER_FLAGS,
+#elif defined(USE_POWER_EMA)
+    .flags  = SAVE_EMA | FILTER_FLAGS,
+#else
+    .flags  = FILTER_FLAGS,
+#endif
+    .window = MAX_RMS_SAMPLES,
+};
+
+// Saving and loading walk the same fields, so the walk is written once.
+#define WALK_STATE(F, C, S)                                         \
+    do {                                                            \
+        for (int i = 0; i < 2; i++) {                               \
+            WALK_POWER(F, C, &(S)->power[i]);                       \
+            WALK_FILTER(F, C, &(S)->filt[i]);                       \
+        }                                                           \
+        F(C, (S)->level.peak);                                      \
+        F(C, (S)->level.floor);                                     \
+        F(C, (S)->level.gain);                                      \
+        F(C, (S)->level.hold);                                      \
+        F(C, (S)->squelch.peak);                                    \
+        F(C, (S)->squelch.closed);                                  \
+        F(C, (S)->run.current);                                     \
+        F(C, (S)->dec.off);                                         \
+        F(C, (S)->dec.last);                                        \
+        F(C, (S)->dec.bit);                                         \
+        F(C, (S)->dec.byte);                                        \
+    } while (0)
+
+#if defined(USE_POWER_EMA)
+#define WALK_POWER(F, C, P)                                         \
+    do {                                                            \
+        F(C, (P)->sum);                                             \
+        F(C, (P)->count);                                           \
+        F(C, (P)->primed);                                          \
+    } while (0)
+#else
+#define WALK_POWER(F, C, P)                                         \
+    do {                                                            \
+        for (int k = 0; k < MAX_RMS_SAMPLES; k++)                   \
+            F(C, (P)->window[k]);                                   \
+        F(C, (P)->sum);                                             \
+        F(C, (P)->ptr);                                             \
+        F(C, (P)->primed);                                          \
+    } while (0)
+#endif
+
+#if defined(USE_FILTER_TDF2)
+#define WALK_FILTER(F, C, P)                                        \
+    do {                                                            \
+        F(C, (P)->sum[0]);                                          \
+        F(C, (P)->sum[1]);                                          \
+    } while (0)
+#else
+#define WALK_FILTER(F, C, P)                                        \
+    do {                                                            \
+        for (int j = 0; j < 3; j++)                                 \
+            F(C, (P)->in[j]);                                       \
+        for (int j = 0; j < 3; j++)                                 \
+            F(C, (P)->out[j]);                                      \
+        F(C, (P)->ptr);                                             \
+    } while (0)
+#endif
+
+// A state that loads in full may still be corrupt. Refuse any that would
+// take the decoder outside its arrays or shifts.
+static bool valid(const DECODE_STATE *s)
+{
+    for (int i = 0; i < 2; i++) {
+        if (! load_bool_valid(&s->power[i].primed))
+            return false;
+#if ! defined(USE_POWER_EMA)
+        if (s->power[i].ptr >= MAX_RMS_SAMPLES)
+            return false;
+#endif
+#if ! defined(USE_FILTER_TDF2)
+        if (s->filt[i].ptr >= 3)
+            return false;
+#endif
+    }
+
+    // narrow() shifts by NARROW_SHIFT - gain
+    return s->level.gain <= NARROW_SHIFT && load_bool_valid(&s->squelch.closed);
+}
+
+size_t CAT(decode_state_save,DECODE_BITS)(const DECODE_STATE *s, void *buf, size_t size)
+{
+    struct save_cursor c = { .at = (unsigned char *)buf, .end = (unsigned char *)buf + size };
+    save_header(&c, &header);
+    WALK_STATE(SAVE_FIELD, &c, s);
+    return c.used;
+}
+
+const char *CAT(decode_state_load,DECODE_BITS)(DECODE_STATE *s, const void *buf, size_t size)
+{
+    struct load_cursor c = { .at = (const unsigned char *)buf, .end = (const unsigned char *)buf + size };
+    const char *why = load_header(&c, &header);
+    if (why)
+        return why;
+
+    // Load into a copy, so that a truncated state leaves `s` as it was
+    DECODE_STATE loaded = *s;
+    WALK_STATE(LOAD_FIELD, &c, &loaded);
+    if (c.short_read)
+        return "saved state is truncated";
+    if (! valid(&loaded))
+        return "saved state is corrupt";
+
+    *s = loaded;
+    return NULL;
+}
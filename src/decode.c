@@ -33,19 +33,37 @@
 #define PROGMEM
 #endif
 
-static bool decode(const SERIAL_CONFIG *c, struct bits_state *s, int8_t offset, DECODE_IN_DATA datum, char *out)
+static int16_t nudge_clock(int16_t off, int16_t period, int8_t offset)
 {
+    // A transition is expected `offset` samples before a sampling point.
+    // Compute how far away from that the clock is, taking the nearer of the
+    // two candidate sampling points.
+    int16_t error = (int16_t)(offset * BIT_CLOCK_ONE - off);
+    if (error < -period / 2)
+        error = (int16_t)(error + period);
+    else if (error >= period / 2)
+        error = (int16_t)(error - period);
+
+    off = (int16_t)(off + (error >> BIT_CLOCK_PLL_SHIFT));
+    return off < 0 ? 0 : off;
+}
+
+static bool decode(const SERIAL_CONFIG *c, struct bits_state *s, uint16_t bit_period, int8_t offset, DECODE_IN_DATA datum, char *out)
+{
+    const int16_t period = (int16_t)bit_period;
     const uint8_t before_parity = (uint8_t)(NUM_START_BITS + c->data_bits);
     const uint8_t before_stop   = (uint8_t)(before_parity + c->parity_bits);
     do {
         if (s->bit == 0 && datum >= THRESHOLD && s->last < THRESHOLD) {
-            s->off = offset;
+            s->off = (int16_t)(offset * BIT_CLOCK_ONE);
+        } else if (s->bit > 0 && (datum < THRESHOLD) != (s->last < THRESHOLD)) {
+            s->off = nudge_clock(s->off, period, offset);
         }
 
         if (s->off < 0)
             break;
 
-        if (s->off == 0) {
+        if (s->off < BIT_CLOCK_ONE) {
             // sample here
             uint8_t this_bit = datum < 0;
 
@@ -77,38 +95,168 @@ static bool decode(const SERIAL_CONFIG *c, struct bits_state *s, int8_t offset,
                 s->byte = 0;
                 s->bit = 0;
                 s->off = -1;
+                s->last = datum;
                 return true;
             } else {
                 s->bit++;
             }
 
-            s->off = SAMPLES_PER_BIT;
+            s->off = (int16_t)(s->off + period);
         }
+
+        s->off = (int16_t)(s->off - BIT_CLOCK_ONE);
     } while (0);
 
     s->last = datum;
-    s->off--;
     return false;
 }
 
+#if defined(USE_POWER_EMA)
+// Approximates the windowed sum below with an exponential moving average.
+// An average with a time constant of T samples weighs about as much history
+// as a window of 2T samples, so T is the power of two nearest to half of
+// `window_size`, and the output is about half the size of a windowed sum.
+// No window buffer is needed, so the window size is not limited.
 static bool power(const uint8_t window_size, struct power_state *s, RMS_IN_DATA datum, RMS_OUT_DATA *out)
 {
+    uint8_t shift = 0;
+    while ((3u << shift) <= window_size)
+        shift++;
+
+    const RMS_OUT_DATA decayed = (RMS_OUT_DATA)(s->sum - (s->sum >> shift));
+    const RMS_OUT_DATA square = (RMS_OUT_DATA)(datum * datum);
+    const RMS_OUT_DATA headroom = (RMS_OUT_DATA)(UINT16_MAX - decayed);
+    // saturate rather than wrap around
+    s->sum = (RMS_OUT_DATA)(square > headroom ? UINT16_MAX : decayed + square);
+
+    if (! s->primed && ++s->count >= (1u << shift))
+        s->primed = true;
+
+    if (s->primed)
+        *out = s->sum;
+
+    return s->primed;
+}
+#else
+static bool power(const uint8_t window_size, struct power_state *s, RMS_IN_DATA datum, RMS_OUT_DATA *out)
+{
+#if defined(USE_FLOATING_POINT)
+    // A running sum would drift in floating point, and the window is short
+    // enough to add up every time. Entries past window_size stay zero.
+    s->window[s->ptr] = datum * datum;
+    RMS_OUT_DATA sum = 0;
+    for (uint8_t i = 0; i < MAX_RMS_SAMPLES; i++)
+        sum += s->window[i];
+    s->sum = sum;
+#else
     s->sum -= s->window[s->ptr];
     s->window[s->ptr] = (RMS_OUT_DATA)(datum * datum);
     s->sum += s->window[s->ptr];
+#endif
 
-    if (s->ptr == window_size - 1)
-        s->primed = true;
+    s->primed |= s->ptr == window_size - 1;
 
-    // Avoid expensive modulo
-    if (++s->ptr >= window_size)
-        s->ptr = 0;
+    // Avoid expensive modulo, and a branch that the members of an ensemble
+    // with different window sizes would keep mispredicting
+    const uint8_t next = (uint8_t)(s->ptr + 1);
+    s->ptr = next >= window_size ? 0 : next;
 
     if (s->primed)
         *out = s->sum;
 
     return s->primed;
 }
+#endif
+
+#if defined(USE_FLOATING_POINT)
+// Scales a filter output to what power() takes, amplifying it by 2^gain.
+static RMS_IN_DATA narrow(FILTER_OUT_DATA x, uint8_t gain)
+{
+    return x * ((float)(1 << gain) / (1 << NARROW_SHIFT));
+}
+#else
+// Narrows a filter output to what power() takes, amplifying it by 2^gain
+// first and saturating.
+static RMS_IN_DATA narrow(FILTER_OUT_DATA x, uint8_t gain)
+{
+    const int y = x >> (NARROW_SHIFT - gain);
+    return (RMS_IN_DATA)(y > INT8_MAX ? INT8_MAX : y < INT8_MIN ? INT8_MIN : y);
+}
+#endif
+
+#if defined(USE_FLOATING_POINT)
+// Shifts levels as the fixed-point versions below do, minus the rounding and
+// the saturation.
+#define LEVEL_SHIFT_DOWN(X,N) ((X) * (1.0f / (1 << (N))))
+#define LEVEL_SHIFT_UP(X,N)   LEVEL_SHIFT_DOWN(X,N)
+
+static RMS_OUT_DATA scale_level(RMS_OUT_DATA x, bool up)
+{
+    return up ? x * 4 : x / 4;
+}
+#else
+#define LEVEL_SHIFT_DOWN(X,N) ((X) >> (N))
+#define LEVEL_SHIFT_UP(X,N)   (((X) >> (N)) | 1) // so that the floor can rise
+
+static RMS_OUT_DATA scale_level(RMS_OUT_DATA x, bool up)
+{
+    return (RMS_OUT_DATA)(! up ? x >> 2 : x > UINT16_MAX >> 2 ? UINT16_MAX : x << 2);
+}
+#endif
+
+// Follows the line level and noise floor in the outputs of power(), and
+// returns the gate below which neither tone is taken to be present. The gain
+// moves a step (a factor of four in power) at a time, and only between words,
+// so that no word sees two gains.
+static RMS_OUT_DATA adapt(const uint8_t window_size, RMS_OUT_DATA threshold, struct level_state *s, bool idle, RMS_OUT_DATA ra, RMS_OUT_DATA rb)
+{
+    const RMS_OUT_DATA strong = ra > rb ? ra : rb;
+    const RMS_OUT_DATA weak   = ra > rb ? rb : ra;
+
+    const RMS_OUT_DATA decayed = (RMS_OUT_DATA)(s->peak - LEVEL_SHIFT_DOWN(s->peak, 6));
+    s->peak = strong > decayed ? strong : decayed;
+
+    if (weak < s->floor)
+        s->floor = (RMS_OUT_DATA)(s->floor - LEVEL_SHIFT_DOWN(s->floor - weak, FLOOR_FALL_SHIFT));
+    else
+        s->floor = (RMS_OUT_DATA)(s->floor + LEVEL_SHIFT_UP(weak - s->floor, FLOOR_RISE_SHIFT));
+
+    // power() sums window_size squares
+    const uint32_t low  = (uint32_t)window_size << (2 * LEVEL_LOW_SHIFT);
+    const uint32_t high = (uint32_t)window_size << (2 * LEVEL_HIGH_SHIFT);
+    const uint8_t most = NARROW_SHIFT;
+
+    if (s->hold > 0) {
+        s->hold--;
+    } else if (idle && s->peak > high && s->gain > 0) {
+        s->gain--;
+        s->peak = scale_level(s->peak, false);
+        s->floor = scale_level(s->floor, false);
+        s->hold = window_size; // until the window holds only the new gain
+    } else if (idle && s->peak < low && s->gain < most) {
+        s->gain++;
+        s->peak = scale_level(s->peak, true);
+        s->floor = scale_level(s->floor, true);
+        s->hold = LEVEL_HOLD;
+    }
+
+#if defined(USE_FLOATING_POINT)
+    const RMS_OUT_DATA gate = s->floor * (1 << GATE_SHIFT);
+#else
+    const uint32_t wide = (uint32_t)s->floor << GATE_SHIFT;
+    const RMS_OUT_DATA gate = wide > UINT16_MAX ? UINT16_MAX : (RMS_OUT_DATA)wide;
+#endif
+    return gate > threshold ? gate : threshold;
+}
+
+static void reset_power(struct power_state *s)
+{
+#if ! defined(USE_POWER_EMA)
+    for (uint8_t i = 0; i < MAX_RMS_SAMPLES; i++)
+        s->window[i] = 0;
+#endif
+    s->sum = 0;
+}
 
 static bool runs(int8_t hysteresis, struct runs_state *s, RUNS_IN_DATA da, RUNS_IN_DATA db, RUNS_OUT_DATA *out)
 {
@@ -131,19 +279,72 @@ static bool runs(int8_t hysteresis, struct runs_state *s, RUNS_IN_DATA da, RUNS_
     return true;
 }
 
+#define RAW_COEFF(Type,Index) c->coeff_##Type##Index
+#if ! defined(__AVR__) || defined(__AVR_PM_BASE_ADDRESS__)
+#define COEFF(Type,Index) RAW_COEFF(Type,Index)
+#else
+#define COEFF(Type,Index) (FILTER_COEFF)pgm_read_word(&RAW_COEFF(Type,Index))
+#endif
+
+#if defined(USE_FILTER_TDF2)
+#if defined(USE_FLOATING_POINT)
+#define SUM_MULT(a, b) ((a) * (b))
+#define SUM_SHRINK(x) (x)
+#else
+// widened explicitly, since an int may have only 16 bits (as on AVR)
+#define SUM_MULT(a, b) ((FILTER_SUM_DATA)(a) * (b))
+#define SUM_SHRINK(x) ((x) >> COEFF_FRACTIONAL_BITS)
+#endif
+
+// Transposed direct form II. The notches in coeff.h have b2 == b0 and
+// b1 == a1, so the output and the sums for the next sample are
+//
+//     y      = b0 x + sum[0]
+//     sum[0] = a1 (x - y) + sum[1]
+//     sum[1] = b0 x - a2 y
+//
+// which takes three multiplies and keeps no history to index into. In fixed
+// point, x and y are in the units of FILTER_STATE_DATA, and the sums carry
+// COEFF_FRACTIONAL_BITS more. notches_peak() bounds every sum formed here, for
+// any input, as a multiple of the largest input magnitude; an int32_t holds
+// sums up to FILTER_SUM_LIMIT (4) times it. For coeff_table the bound is 2.9,
+// and for every profile at rates from 4650 Hz to 44100 Hz it is under 3.8.
+static bool filter(const struct filter_config * PROGMEM c, struct filter_state *s, FILTER_IN_DATA datum, FILTER_OUT_DATA *out)
+{
+    const FILTER_SUM_DATA x = EXPAND(datum, FILTER_STATE_DATA);
+    const FILTER_SUM_DATA bx = SUM_MULT(COEFF(b, 0), x);
+    const FILTER_SUM_DATA y = SUM_SHRINK(bx + s->sum[0]);
+
+    s->sum[0] = SUM_MULT(COEFF(a, 1), x - y) + s->sum[1];
+    s->sum[1] = bx - SUM_MULT(COEFF(a, 2), y);
+
+    *out = (FILTER_OUT_DATA)SHRINK((FILTER_STATE_DATA)y, FILTER_OUT_DATA);
+
+    return true;
+}
+
+static void rest(struct filter_state *s)
+{
+    s->sum[0] = 0;
+    s->sum[1] = 0;
+}
+
+// Runs the filter with its output held at zero (see squelch())
+static void hush(const struct filter_config * PROGMEM c, struct filter_state *s, FILTER_IN_DATA datum)
+{
+    const FILTER_SUM_DATA x = EXPAND(datum, FILTER_STATE_DATA);
+    s->sum[0] = SUM_MULT(COEFF(a, 1), x) + s->sum[1];
+    s->sum[1] = SUM_MULT(COEFF(b, 0), x);
+}
+#else
+// Avoid expensive modulo
+#define MOD(x,n) ((x) >= (n) ? (x) - (n) : (x))
+
 static bool filter(const struct filter_config * PROGMEM c, struct filter_state *s, FILTER_IN_DATA datum, FILTER_OUT_DATA *out)
 {
     s->in[s->ptr] = datum;
 
-    // Avoid expensive modulo
-    #define MOD(x,n) ((x) >= (n) ? (x) - (n) : (x))
     #define INDEX(x,n) (x)[MOD(s->ptr + (n) + 3, 3)]
-    #define RAW_COEFF(Type,Index) c->coeff_##Type##Index
-#if ! defined(__AVR__) || defined(__AVR_PM_BASE_ADDRESS__)
-    #define COEFF(Type,Index) RAW_COEFF(Type,Index)
-#else
-    #define COEFF(Type,Index) (FILTER_COEFF)pgm_read_word(&RAW_COEFF(Type,Index))
-#endif
 
     s->out[s->ptr] = 0
         + FILTER_MULT(COEFF(b, 0), EXPAND(INDEX(s->in,  0), FILTER_STATE_DATA))
@@ -163,6 +364,143 @@ static bool filter(const struct filter_config * PROGMEM c, struct filter_state *
     return true;
 }
 
+static void rest(struct filter_state *s)
+{
+    for (int j = 0; j < 3; j++)
+        s->out[j] = 0;
+}
+
+// Runs the filter with its output held at zero (see squelch())
+static void hush(const struct filter_config * PROGMEM c, struct filter_state *s, FILTER_IN_DATA datum)
+{
+    (void)c;
+    s->in[s->ptr] = datum;
+    s->out[s->ptr] = 0;
+    s->ptr = (uint8_t)MOD(s->ptr + 1, 3);
+}
+#endif
+
+// Follows the input's peak amplitude. While that stays under `level`, the
+// filters run with their outputs held at zero (so that they pick up again as
+// if they had been running on the quiet all along), and nothing else runs.
+// Returns whether the rest of the decoder should run.
+static bool squelch(uint16_t level, const struct filter_config *coeffs, DECODE_STATE *s, FILTER_IN_DATA datum)
+{
+    struct squelch_state *q = &s->squelch;
+    const uint16_t magnitude = (uint16_t)(datum < 0 ? -(int32_t)datum : datum);
+    // decay by at least one, so that small peaks do not stick
+    const uint16_t decayed = (uint16_t)(q->peak - (q->peak >> SQUELCH_DECAY_SHIFT) - (q->peak > 0));
+    q->peak = magnitude > decayed ? magnitude : decayed;
+
+    if (q->peak >= level) {
+        q->closed = false;
+        return true;
+    }
+
+    if (! q->closed) {
+        // What remains in the filters and power windows is too quiet to
+        // matter, so let the next carrier find them at rest.
+        for (int i = 0; i < 2; i++) {
+            rest(&s->filt[i]);
+            reset_power(&s->power[i]);
+        }
+        q->closed = true;
+    }
+
+    hush(&coeffs[BIT_ZERO], &s->filt[0], datum);
+    hush(&coeffs[BIT_ONE ], &s->filt[1], datum);
+
+    return false;
+}
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+// Runs the squelch and the filters, which the members of an ensemble share.
+// Returns whether the rest of the decoder should run.
+static ALWAYS_INLINE bool front(
+        const AUDIO_CONFIG *audio,
+        const struct filter_config *coeffs,
+        DECODE_STATE *s,
+        FILTER_IN_DATA in,
+        FILTER_OUT_DATA f[2]
+    )
+{
+    if (audio->squelch && ! squelch(audio->squelch, coeffs, s, in))
+        return false;
+
+    return filter(&coeffs[BIT_ZERO], &s->filt[0], in, &f[0])
+        && filter(&coeffs[BIT_ONE ], &s->filt[1], in, &f[1]);
+}
+
+// Measures the power of each tone from the filters' outputs `f` for the
+// sample `in`. Returns whether the power windows have filled.
+static ALWAYS_INLINE bool measure(
+        const uint8_t window_size,
+        DECODE_STATE *s,
+        const FILTER_OUT_DATA f[2],
+        FILTER_IN_DATA in,
+        RMS_OUT_DATA *ra,
+        RMS_OUT_DATA *rb
+    )
+{
+    // the gain stays at zero unless audio->adaptive is set
+    const uint8_t gain = s->level.gain;
+
+    return power(window_size, &s->power[0], narrow((FILTER_OUT_DATA)(f[0] - in), gain), ra)
+        && power(window_size, &s->power[1], narrow((FILTER_OUT_DATA)(f[1] - in), gain), rb);
+}
+
+// Runs the gate, runs() and decode() on the tones' powers
+static ALWAYS_INLINE bool detect(
+        const SERIAL_CONFIG *c,
+        const uint8_t window_size,
+        const AUDIO_CONFIG *audio,
+        DECODE_STATE *s,
+        RMS_OUT_DATA ra,
+        RMS_OUT_DATA rb,
+        char *out
+    )
+{
+    RMS_OUT_DATA gate = audio->threshold;
+    if (audio->adaptive)
+        gate = adapt(window_size, audio->threshold, &s->level, s->dec.off < 0, ra, rb);
+
+    if (ra < gate && rb < gate)
+        return false;
+
+    RUNS_OUT_DATA ro = 0;
+    if (! runs(audio->hysteresis, &s->run, ra, rb, &ro))
+        return false;
+
+    return decode(c, &s->dec, audio->bit_period, audio->offset, ro, out);
+}
+
+// The serial configuration and window size are passed separately from the
+// rest of the configuration so that the specialized variants below can make
+// them compile-time constants.
+static ALWAYS_INLINE bool pump(
+        const SERIAL_CONFIG *c,
+        const uint8_t window_size,
+        const AUDIO_CONFIG *audio,
+        const struct filter_config *coeffs,
+        DECODE_STATE *s,
+        void *p,
+        char *out
+    )
+{
+    DECODE_DATA_TYPE *in = (DECODE_DATA_TYPE*)p;
+
+    FILTER_OUT_DATA f[2] = { 0 };
+    RMS_OUT_DATA ra = 0, rb = 0;
+    return front(audio, coeffs, s, *in, f)
+        && measure(window_size, s, f, *in, &ra, &rb)
+        && detect(c, window_size, audio, s, ra, rb, out);
+}
+
 bool CAT(pump_decoder,DECODE_BITS)(
         const SERIAL_CONFIG *c,
         const AUDIO_CONFIG *audio,
@@ -171,30 +509,102 @@ bool CAT(pump_decoder,DECODE_BITS)(
         void *p,
         char *out
     )
+{
+    return pump(c, audio->window_size, audio, coeffs, s, p, out);
+}
+
+#if ! defined(__AVR__)
+// decode() looks only at the number of data and parity bits, so 7E2 (as in
+// `listen`) and 7O1 share a variant, and 8N1 gets the other one.
+#define DECODE_FRAMINGS(_) \
+    _(7, 1) \
+    _(8, 0) \
+    // end macro
+
+#define DECODE_WINDOWS(_, Data, Parity) \
+    _(Data, Parity, 4) \
+    _(Data, Parity, 5) \
+    _(Data, Parity, 6) \
+    _(Data, Parity, 7) \
+    _(Data, Parity, 8) \
+    // end macro
+
+#define VARIANT_NAME(Data, Parity, Window) \
+    CAT(CAT(CAT(pump_decoder,DECODE_BITS),CAT(_,Data)),CAT(CAT(_,Parity),CAT(_,Window)))
+
+#define DEFINE_VARIANT(Data, Parity, Window) \
+    static bool VARIANT_NAME(Data, Parity, Window)( \
+            const SERIAL_CONFIG *c, \
+            const AUDIO_CONFIG *audio, \
+            const struct filter_config *coeffs, \
+            DECODE_STATE *s, \
+            void *p, \
+            char *out \
+        ) \
+    { \
+        static const SERIAL_CONFIG fixed = { \
+            .data_bits   = Data, \
+            .parity_bits = Parity, \
+        }; \
+        (void)c; \
+        return pump(&fixed, Window, audio, coeffs, s, p, out); \
+    } \
+    // end macro
+
+#define DEFINE_VARIANTS(Data, Parity) DECODE_WINDOWS(DEFINE_VARIANT, Data, Parity)
+DECODE_FRAMINGS(DEFINE_VARIANTS)
+
+unsigned CAT(pump_ensemble,DECODE_BITS)(
+        const SERIAL_CONFIG *c,
+        const ENSEMBLE_CONFIG *e,
+        const struct filter_config *coeffs,
+        DECODE_STATE *s[],
+        void *p,
+        char out[]
+    )
 {
     DECODE_DATA_TYPE *in = (DECODE_DATA_TYPE*)p;
 
+    const bool was_closed = s[0]->squelch.closed;
     FILTER_OUT_DATA f[2] = { 0 };
-    if (
-            ! filter(&coeffs[BIT_ZERO], &s->filt[0], *in, &f[0])
-        ||  ! filter(&coeffs[BIT_ONE ], &s->filt[1], *in, &f[1])
-        )
-        return false;
+    if (! front(&e->audio[0], coeffs, s[0], *in, f)) {
+        // squelch() let the first member's windows go; the others' go too
+        if (! was_closed && s[0]->squelch.closed) {
+            for (uint8_t m = 1; m < e->members; m++) {
+                reset_power(&s[m]->power[0]);
+                reset_power(&s[m]->power[1]);
+            }
+        }
+        return 0;
+    }
 
+    unsigned done = 0;
     RMS_OUT_DATA ra = 0, rb = 0;
-    if (
-            ! power(audio->window_size, &s->power[0], (int8_t)SHRINK((FILTER_OUT_DATA)(f[0] - *in), int8_t), &ra)
-        ||  ! power(audio->window_size, &s->power[1], (int8_t)SHRINK((FILTER_OUT_DATA)(f[1] - *in), int8_t), &rb)
-        )
-        return false;
+    bool measured = false;
+    for (uint8_t m = 0; m < e->members; m++) {
+        const AUDIO_CONFIG *audio = &e->audio[m];
+        // Unless adapt() sets either one's gain apart, a member measures the
+        // same power as the one before it if their windows are the same size.
+        if (m == 0 || audio->adaptive || e->audio[m - 1].adaptive ||
+                audio->window_size != e->audio[m - 1].window_size)
+            measured = measure(audio->window_size, s[m], f, *in, &ra, &rb);
+
+        if (measured && detect(c, audio->window_size, audio, s[m], ra, rb, &out[m]))
+            done |= 1u << m;
+    }
+
+    return done;
+}
 
-    if (ra < audio->threshold && rb < audio->threshold)
-        return false;
+decode_pumper *CAT(select_decoder,DECODE_BITS)(const SERIAL_CONFIG *c, const AUDIO_CONFIG *audio)
+{
+    #define MATCH_VARIANT(Data, Parity, Window) \
+        if (c->data_bits == Data && c->parity_bits == Parity && audio->window_size == Window) \
+            return VARIANT_NAME(Data, Parity, Window);
+    #define MATCH_VARIANTS(Data, Parity) DECODE_WINDOWS(MATCH_VARIANT, Data, Parity)
 
-    RUNS_OUT_DATA ro = 0;
-    if (! runs(audio->hysteresis, &s->run, ra, rb, &ro))
-        return false;
+    DECODE_FRAMINGS(MATCH_VARIANTS)
 
-    return decode(c, &s->dec, audio->offset, ro, out);
+    return CAT(pump_decoder,DECODE_BITS);
 }
-
+#endif
@@ -26,20 +26,37 @@
 #include "types.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define DECODE_DATA_TYPE SIZED(DECODE_BITS)
 
+#if defined(USE_POWER_EMA)
+#define MAX_RMS_SAMPLES UINT8_MAX
+#else
+#define MAX_RMS_SAMPLES 8
+#endif
+
+#if defined(USE_FLOATING_POINT)
+#if defined(USE_POWER_EMA)
+#error "USE_POWER_EMA is supported only in fixed point"
+#endif
+typedef float RMS_OUT_DATA;
+#else
 typedef uint16_t RMS_OUT_DATA;
+#endif
 
 struct filter_config;
 
 typedef struct {
     enum channel channel;
-    uint8_t      window_size;
+    uint8_t      window_size; // with USE_POWER_EMA, twice the time constant
     RMS_OUT_DATA threshold;
     int8_t       hysteresis;
     int8_t       offset;
+    uint16_t     bit_period; // see BIT_PERIOD()
+    bool         adaptive; // set the gate and level from the line itself
+    uint16_t     squelch; // input amplitude below which filtering stops; 0 for none
 } AUDIO_CONFIG;
 
 typedef struct decode_state DECODE_STATE;
@@ -56,5 +73,45 @@ typedef bool decode_pumper(
         char *out
     );
 
+// An ensemble decodes one line with several back ends (everything after the
+// filters: power, gate, runs and bit decoding), each with a configuration of
+// its own, sharing the squelch and filters of the first. Members that are not
+// adaptive share power measurements too, with the member before them if their
+// window sizes are the same, so that a member differing only in its
+// threshold, hysteresis or offset costs well under a whole decoder.
+// Members take their states from the same decode_init, and vote.h combines
+// their bytes.
+#define ENSEMBLE_MAX 7
+
+typedef struct {
+    uint8_t      members;
+    AUDIO_CONFIG audio[ENSEMBLE_MAX]; // the first gives the squelch
+} ENSEMBLE_CONFIG;
+
+// Runs one sample through every member of an ensemble, returning a mask of
+// the members that completed a byte, which each leaves at its index in `out`.
+typedef unsigned ensemble_pumper(
+        const SERIAL_CONFIG *config,
+        const ENSEMBLE_CONFIG *ensemble,
+        const struct filter_config *coeffs,
+        DECODE_STATE *s[],
+        void *in,
+        char out[]
+    );
+
+// Saves the whole of a decoder's state to `buf` (see save.h), returning the
+// number of bytes that it needs; if that is more than `size`, the state was
+// cut short and must be saved again with more room.
+typedef size_t decode_saver(const DECODE_STATE *s, void *buf, size_t size);
+
+// Restores a state saved by the same build of the decoder, returning NULL,
+// or else why it could not, leaving `s` unchanged.
+typedef const char *decode_loader(DECODE_STATE *s, const void *buf, size_t size);
+
+// Returns a variant of the pumper specialized for the given configurations,
+// or the generic one if there is no such variant. Only `audio->window_size`
+// and the fields of `config` that affect framing are taken into account.
+typedef decode_pumper *decode_selector(const SERIAL_CONFIG *config, const AUDIO_CONFIG *audio);
+
 #endif
 
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "pool.h"
+#include "state.h"
+
+// The most encoder states in use at once
+#if ! defined(ENCODE_POOL_SIZE)
+#define ENCODE_POOL_SIZE 4096
+#endif
+
+static struct { alignas(POOL_ALIGN) BYTE_STATE state; } states[ENCODE_POOL_SIZE];
+static _Atomic uint32_t links[ENCODE_POOL_SIZE];
+static struct pool pool = POOL_INITIALIZER(states, links);
+
+// Returns NULL when ENCODE_POOL_SIZE states are already in use.
+BYTE_STATE *encode_state_init(void)
+{
+    BYTE_STATE *state = pool_get(&pool);
+    if (state)
+        *state = (BYTE_STATE){ .channel = CHAN_ZERO };
+
+    return state;
+}
+
+void encode_state_fini(BYTE_STATE *s)
+{
+    if (s)
+        pool_put(&pool, s);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "save.h"
+#include "state.h"
+
+// Every field of the state is saved, except the sine table that the sample
+// state points to, which belongs to the process; a state is loaded into one
+// whose table has already been set up (see sines_init).
+
+static const struct save_header header = { .kind = SAVE_ENCODER };
+
+#define WALK_STATE(F, C, S)                                         \
+    do {                                                            \
+        F(C, (S)->bit_state.sample_state.phase);                    \
+        for (int i = 0; i < CHAN_max; i++)                          \
+            for (int j = 0; j < BIT_max; j++)                       \
+                F(C, (S)->bit_state.steps[i][j]);                   \
+        F(C, (S)->bit_state.step);                                  \
+        F(C, (S)->bit_state.bit_period);                            \
+        F(C, (S)->bit_state.clock);                                 \
+        F(C, (S)->bit_state.channel);                               \
+        F(C, (S)->channel);                                         \
+        F(C, (S)->current_word);                                    \
+        F(C, (S)->next_word);                                       \
+        F(C, (S)->bits_remaining);                                  \
+        F(C, (S)->buffer_full);                                     \
+    } while (0)
+
+// A state that loads in full may still be corrupt. Refuse any whose
+// channels would index outside the table of phase steps.
+static bool valid(const BYTE_STATE *s)
+{
+    return (unsigned)s->channel < CHAN_max && (unsigned)s->bit_state.channel < CHAN_max &&
+        load_bool_valid(&s->buffer_full);
+}
+
+size_t encode_state_save(const BYTE_STATE *s, void *buf, size_t size)
+{
+    struct save_cursor c = { .at = (unsigned char *)buf, .end = (unsigned char *)buf + size };
+    save_header(&c, &header);
+    WALK_STATE(SAVE_FIELD, &c, s);
+    return c.used;
+}
+
+const char *encode_state_load(BYTE_STATE *s, const void *buf, size_t size)
+{
+    struct load_cursor c = { .at = (const unsigned char *)buf, .end = (const unsigned char *)buf + size };
+    const char *why = load_header(&c, &header);
+    if (why)
+        return why;
+
+    BYTE_STATE loaded = *s;
+    WALK_STATE(LOAD_FIELD, &c, &loaded);
+    if (c.short_read)
+        return "saved state is truncated";
+    if (! valid(&loaded))
+        return "saved state is corrupt";
+
+    *s = loaded;
+    return NULL;
+}
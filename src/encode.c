@@ -46,38 +46,68 @@ static void encode_sample(SAMPLE_STATE *s, PHASE_STEP step, DATA_TYPE *out)
     *out = ((ENCODE_DATA_TYPE*)s->quadrant)[lookup] ^ half;
 }
 
-static inline PHASE_STEP get_phase_step(uint16_t freq)
-{
-    return (PHASE_STEP)(MINOR_PER_CYCLE * freq / SAMPLE_RATE);
-}
+#if defined(__GNUC__) && ! defined(__AVR__)
+#define ENCODE_LANES 16
+typedef PHASE_TYPE PHASE_VECTOR __attribute__((vector_size(ENCODE_LANES * sizeof(PHASE_TYPE))));
+#endif
 
-static inline uint16_t get_frequency(enum channel channel, enum bit bit)
+// Produces the same output as `count` calls to encode_sample(), but hosts
+// with vector extensions compute ENCODE_LANES phases at a time.
+static void encode_samples(SAMPLE_STATE *s, PHASE_STEP step, size_t count, DATA_TYPE *out)
 {
-    #define INIT_2D_ARRAY(X,Y,Z) [X][Y] = Z,
+    size_t i = 0;
+
+#if defined(ENCODE_LANES)
+    const DATA_TYPE *quadrant = (const DATA_TYPE *)s->quadrant;
+
+    PHASE_VECTOR phase;
+    for (int j = 0; j < ENCODE_LANES; j++)
+        phase[j] = (PHASE_TYPE)(s->phase + j * step);
+
+    const PHASE_VECTOR stride = (PHASE_VECTOR){ 0 } + (PHASE_TYPE)(ENCODE_LANES * step);
 
-    static const uint16_t freqs[CHAN_max][BIT_max] = { FREQUENCY_LIST(INIT_2D_ARRAY) };
+    for (; i + ENCODE_LANES <= count; i += ENCODE_LANES) {
+        const PHASE_VECTOR top     = phase >> PHASE_FRACTION_BITS;
+        const PHASE_VECTOR half    = -((top >> 7) & 1);
+        const PHASE_VECTOR quarter = -((top >> 6) & 1);
+        const PHASE_VECTOR lookup  = (top ^ quarter) % WAVE_TABLE_SIZE;
+
+        for (int j = 0; j < ENCODE_LANES; j++)
+            out[i + j] = (DATA_TYPE)(quadrant[lookup[j]] ^ (DATA_TYPE)half[j]);
+
+        phase += stride;
+    }
+
+    s->phase = (PHASE_TYPE)(s->phase + i * step);
+#endif
+
+    for (; i < count; i++)
+        encode_sample(s, step, &out[i]);
+}
 
-    return freqs[channel][bit];
+static inline PHASE_STEP get_phase_step(uint16_t freq)
+{
+    return (PHASE_STEP)((uint32_t)MINOR_PER_CYCLE * freq / SAMPLE_RATE);
 }
 
 static bool encode_bit(BIT_STATE *s, bool newbit, enum channel channel, enum bit bit, DATA_TYPE *out)
 {
-    bool busy = s->samples_remaining > 0;
+    bool busy = s->clock >= BIT_CLOCK_ONE;
 
     if (! busy) {
-        s->samples_remaining = SAMPLES_PER_BIT;
+        s->clock = (uint16_t)(s->clock + s->bit_period);
         if (newbit) {
             s->channel = channel;
         } else {
             // if no new bit, switch back to the idle bit in the most-recent channel
             bit = BIT_ONE;
         }
-        s->step = get_phase_step(get_frequency(s->channel, bit));
+        s->step = s->steps[s->channel][bit];
     }
 
-    if (s->samples_remaining) {
+    if (s->clock >= BIT_CLOCK_ONE) {
         encode_sample(&s->sample_state, s->step, out);
-        s->samples_remaining--;
+        s->clock = (uint16_t)(s->clock - BIT_CLOCK_ONE);
     }
 
     return ! busy;
@@ -117,6 +147,7 @@ static bool push_raw_word(BYTE_STATE *s, bool restart, enum channel channel, uin
             s->current_word = s->next_word;
             s->buffer_full = false;
             s->bits_remaining = bit_count;
+            bit = (enum bit)(s->current_word & 1);
             busy = true;
             // FALLTHROUGH
         case BOOL_TRIAD(false, true , true ): // full, emitting
@@ -131,6 +162,78 @@ static bool push_raw_word(BYTE_STATE *s, bool restart, enum channel channel, uin
     return false; // this is meant to be unreachable
 }
 
+void CAT(init_profile,ENCODE_BITS)(BYTE_STATE *s, const MODEM_PROFILE *p)
+{
+    BIT_STATE *b = &s->bit_state;
+    for (int c = 0; c < CHAN_max; c++)
+        for (int i = 0; i < BIT_max; i++)
+            b->steps[c][i] = get_phase_step(p->frequencies[c][i]);
+
+    b->bit_period = BIT_PERIOD(SAMPLE_RATE, p->baud_rate);
+}
+
+// Like push_raw_word, but produces up to `count` samples, stopping early
+// once `word` has been accepted (if `restart` was true). Whenever the state
+// machine has nothing to do but finish the current bit, the rest of the bit
+// is synthesized in one go.
+static size_t fill_raw_words(BYTE_STATE *s, bool restart, enum channel channel, uint8_t bit_count, uint16_t word, bool *accepted, size_t count, DATA_TYPE *out)
+{
+    size_t done = 0;
+    *accepted = false;
+
+    while (done < count) {
+        if (push_raw_word(s, restart, channel, bit_count, word, &out[done++]) && restart) {
+            *accepted = true;
+            break;
+        }
+
+        // The next call would move a word or accept one
+        const bool pending = s->buffer_full ? s->bits_remaining == 0 : restart;
+        if (pending)
+            continue;
+
+        BIT_STATE *b = &s->bit_state;
+        size_t run = b->clock >> BIT_CLOCK_FRACTION_BITS;
+        if (run > count - done)
+            run = count - done;
+
+        encode_samples(&b->sample_state, b->step, run, &out[done]);
+        b->clock = (uint16_t)(b->clock - (run << BIT_CLOCK_FRACTION_BITS));
+        done += run;
+    }
+
+    return done;
+}
+
+// Encodes all of `word` back-to-back, as push_raw_word would when there is
+// always another word waiting, writing at most `count` samples. Must start
+// on a bit boundary. With a NULL `out`, only advances the state.
+static size_t frame_raw_word(BYTE_STATE *s, enum channel channel, uint8_t bit_count, uint16_t word, size_t count, DATA_TYPE *out)
+{
+    BIT_STATE *b = &s->bit_state;
+    size_t done = 0;
+
+    b->channel = channel;
+    for (uint8_t i = 0; i < bit_count && done < count; i++, word >>= 1) {
+        b->clock = (uint16_t)(b->clock + b->bit_period);
+        b->step = b->steps[channel][word & 1];
+
+        size_t run = b->clock >> BIT_CLOCK_FRACTION_BITS;
+        if (run > count - done)
+            run = count - done;
+
+        if (out)
+            encode_samples(&b->sample_state, b->step, run, &out[done]);
+        else
+            b->sample_state.phase = (PHASE_TYPE)(b->sample_state.phase + run * b->step);
+
+        b->clock = (uint16_t)(b->clock - (run << BIT_CLOCK_FRACTION_BITS));
+        done += run;
+    }
+
+    return done;
+}
+
 static inline uint8_t count_bits(const SERIAL_CONFIG *s)
 {
     return (uint8_t)(NUM_START_BITS + s->data_bits + s->parity_bits + s->stop_bits);
@@ -142,6 +245,18 @@ bool CAT(encode_carrier,ENCODE_BITS)(const SERIAL_CONFIG *c, BYTE_STATE *s, bool
     return push_raw_word(s, restart, channel, count_bits(c), (uint16_t)-1u, (DATA_TYPE*)out);
 }
 
+size_t CAT(encode_carrier_block,ENCODE_BITS)(const SERIAL_CONFIG *c, BYTE_STATE *s, bool restart, enum channel channel, char byte, bool *accepted, size_t count, void *out)
+{
+    (void)byte; // unused
+    return fill_raw_words(s, restart, channel, count_bits(c), (uint16_t)-1u, accepted, count, (DATA_TYPE*)out);
+}
+
+size_t CAT(encode_carrier_frame,ENCODE_BITS)(const SERIAL_CONFIG *c, BYTE_STATE *s, enum channel channel, char byte, size_t count, void *out)
+{
+    (void)byte; // unused
+    return frame_raw_word(s, channel, count_bits(c), (uint16_t)-1u, count, (DATA_TYPE*)out);
+}
+
 static inline uint8_t popcnt(char x)
 {
 #if defined(__GNUC__)
@@ -193,3 +308,15 @@ bool CAT(encode_bytes,ENCODE_BITS)(const SERIAL_CONFIG *c, BYTE_STATE *s, bool r
     return push_raw_word(s, restart, channel, bit_count, word, (DATA_TYPE*)out);
 }
 
+size_t CAT(encode_bytes_block,ENCODE_BITS)(const SERIAL_CONFIG *c, BYTE_STATE *s, bool restart, enum channel channel, char byte, bool *accepted, size_t count, void *out)
+{
+    uint8_t bit_count = count_bits(c);
+    uint16_t word = make_word(c, byte);
+    return fill_raw_words(s, restart, channel, bit_count, word, accepted, count, (DATA_TYPE*)out);
+}
+
+size_t CAT(encode_bytes_frame,ENCODE_BITS)(const SERIAL_CONFIG *c, BYTE_STATE *s, enum channel channel, char byte, size_t count, void *out)
+{
+    return frame_raw_word(s, channel, count_bits(c), make_word(c, byte), count, (DATA_TYPE*)out);
+}
+
@@ -26,6 +26,7 @@
 #include "types.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #define ENCODE_DATA_TYPE SIZED(ENCODE_BITS)
 
@@ -33,8 +34,32 @@ typedef struct sample_state SAMPLE_STATE;
 typedef struct bit_state    BIT_STATE;
 typedef struct byte_state   BYTE_STATE;
 
+// hand out and take back encoder states, zeroed, from the heap or from a pool
+// (see encode-heap.c and encode-pool.c)
+typedef BYTE_STATE *encode_init(void);
+typedef void encode_fini(BYTE_STATE *s);
+
+// Save and restore an encoder's state, as decode_saver and decode_loader do.
+// The sine table is not saved, so a state is loaded into one whose table is
+// already set up.
+typedef size_t encode_saver(const BYTE_STATE *s, void *buf, size_t size);
+typedef const char *encode_loader(BYTE_STATE *s, const void *buf, size_t size);
+
+// derives the tone and bit timing parameters for `p` into `s`
+typedef void profile_init(BYTE_STATE *s, const MODEM_PROFILE *p);
+
 // returns whether a new byte was accepted (if `restart` was true)
 typedef bool encode_pusher(const SERIAL_CONFIG *c, BYTE_STATE *s, bool restart, enum channel channel, char byte, void *out);
 
+// like encode_pusher, but writes up to `count` samples to `out` and returns
+// how many it wrote; the last of them is the one that accepted the new byte,
+// if `*accepted` was set
+typedef size_t encode_filler(const SERIAL_CONFIG *c, BYTE_STATE *s, bool restart, enum channel channel, char byte, bool *accepted, size_t count, void *out);
+
+// Encodes the whole word for `byte` starting at a bit boundary, with no
+// buffering, writing at most `count` samples to `out` (or just advancing the
+// phase and bit clock, if `out` is NULL); returns the number of samples
+typedef size_t encode_framer(const SERIAL_CONFIG *c, BYTE_STATE *s, enum channel channel, char byte, size_t count, void *out);
+
 #endif
 
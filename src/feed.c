@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+// `feed` copies a capture onto an audio bus (see bus.h), from which any
+// number of `listen -B` instances can decode it without copies of their own.
+
+#include "bus.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+enum { BLOCK_SIZE = 8192 };
+enum { BUS_SIZE = 1 << 20 };
+
+struct options {
+    const char *name;
+    size_t size;
+    FILE *input_stream;
+    bool keep;          // leave the bus behind for readers that come later
+    bool unlink;        // only remove the bus
+};
+
+static FILE *open_file(const char *filename, const char *mode, FILE *dflt)
+{
+    if (strcmp(filename, "-") == 0)
+        return dflt;
+
+    return fopen(filename, mode);
+}
+
+static int parse_opts(struct options *o, int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "B:s:F:ku")) != -1) {
+        switch (ch) {
+            case 'B': o->name           = optarg;                           break;
+            case 's': o->size           = strtoul(optarg, NULL, 0);         break;
+            case 'F': o->input_stream   = open_file(optarg, "r", stdin);    break;
+            case 'k': o->keep           = true;                             break;
+            case 'u': o->unlink         = true;                             break;
+
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct options opts = {
+        .name = "tynsel",
+        .size = BUS_SIZE,
+    };
+
+    opts.input_stream = stdin;
+    if (parse_opts(&opts, argc, argv))
+        exit(EXIT_FAILURE);
+
+    if (opts.unlink) {
+        if (bus_unlink(opts.name)) {
+            fprintf(stderr, "Failed to remove bus %s : %s\n", opts.name, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+
+    if (! opts.input_stream) {
+        perror("Failed to open input");
+        exit(EXIT_FAILURE);
+    }
+
+    struct bus bus;
+    if (bus_create(&bus, opts.name, opts.size)) {
+        fprintf(stderr, "Failed to create bus %s : %s\n", opts.name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // Pass on whatever input is available at once, as `listen` takes it.
+    const int input_fd = fileno(opts.input_stream);
+    char block[BLOCK_SIZE];
+    while (true) {
+        ssize_t result = read(input_fd, block, sizeof block);
+
+        if (result <= 0) {
+            if (result == 0)
+                break;
+            if (errno == EINTR)
+                continue;
+
+            perror("read failed");
+            exit(EXIT_FAILURE);
+        }
+
+        bus_write(&bus, block, (size_t)result);
+    }
+
+    bus_close(&bus);
+    if (! opts.keep)
+        bus_unlink(opts.name);
+    bus_detach(&bus);
+
+    return 0;
+}
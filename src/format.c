@@ -0,0 +1,347 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "format.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_BIG_ENDIAN true
+#else
+#define HOST_BIG_ENDIAN false
+#endif
+
+static const struct {
+    const char *name;
+    size_t width;
+} encodings[FORMAT_max] = {
+    [FORMAT_U8 ] = { "u8" , 1 },
+    [FORMAT_S8 ] = { "s8" , 1 },
+    [FORMAT_S16] = { "s16", 2 },
+    [FORMAT_S24] = { "s24", 3 },
+    [FORMAT_S32] = { "s32", 4 },
+    [FORMAT_F32] = { "f32", 4 },
+};
+
+int format_parse(const char *name, struct sample_format *f)
+{
+    if (strcmp(name, "wav") == 0) {
+        *f = (struct sample_format){ .encoding = FORMAT_S16, .wav = true };
+        return 0;
+    }
+
+    for (int e = 0; e < FORMAT_max; e++) {
+        const size_t len = strlen(encodings[e].name);
+        if (strncmp(name, encodings[e].name, len) != 0)
+            continue;
+
+        const char *order = name + len;
+        *f = (struct sample_format){ .encoding = (enum sample_encoding)e, .big_endian = HOST_BIG_ENDIAN };
+        if (strcmp(order, "le") == 0)
+            f->big_endian = false;
+        else if (strcmp(order, "be") == 0)
+            f->big_endian = true;
+        else if (*order != '\0')
+            return -1;
+
+        return 0;
+    }
+
+    return -1;
+}
+
+size_t format_width(const struct sample_format *f)
+{
+    return encodings[f->encoding].width;
+}
+
+bool format_is_native(const struct sample_format *f, unsigned bits)
+{
+    if (bits == 8)
+        return f->encoding == FORMAT_S8;
+
+    return bits == 16 && f->encoding == FORMAT_S16 && f->big_endian == HOST_BIG_ENDIAN;
+}
+
+static inline uint16_t load16(const unsigned char *p, bool swap)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof v);
+    return swap ? __builtin_bswap16(v) : v;
+}
+
+static inline uint32_t load32(const unsigned char *p, bool swap)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+static inline uint32_t load24le(const unsigned char *p)
+{
+    return (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+static inline uint32_t load24be(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+static inline void store16(unsigned char *p, uint16_t v, bool swap)
+{
+    v = swap ? __builtin_bswap16(v) : v;
+    memcpy(p, &v, sizeof v);
+}
+
+static inline void store32(unsigned char *p, uint32_t v, bool swap)
+{
+    v = swap ? __builtin_bswap32(v) : v;
+    memcpy(p, &v, sizeof v);
+}
+
+static inline void store24(unsigned char *p, uint32_t v, bool big)
+{
+    p[big ? 0 : 2] = (unsigned char)(v >> 16);
+    p[1]           = (unsigned char)(v >> 8);
+    p[big ? 2 : 0] = (unsigned char)v;
+}
+
+// Clamps to just under full scale, so that the product always fits, and
+// takes NaN as silence. Comparing floats could trap, which stops the compiler
+// from turning comparisons into selects, so the clamp works on the magnitude's
+// bits instead, where it orders the same way. The top 16 bits come out as a
+// clamp to INT32_MAX would leave them.
+static inline int32_t from_float(uint32_t bits)
+{
+    uint32_t mag = bits & 0x7fffffff;
+    mag = mag > 0x7f800000 ? 0 : mag;               // NaN
+    mag = mag < 0x3f7fffff ? mag : 0x3f7fffff;      // just under 1.0f
+    bits = (bits & 0x80000000) | mag;
+
+    float x;
+    memcpy(&x, &bits, sizeof x);
+    return (int32_t)(x * 2147483648.0f);
+}
+
+static inline uint32_t to_float(int32_t full)
+{
+    const float x = (float)full / 2147483648.0f;
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof bits);
+    return bits;
+}
+
+// Every conversion goes through a signed 32-bit sample at full scale, which
+// is then narrowed to (or widened from) the internal width. Each encoding
+// gets loops of its own, with nothing in them to stop the compiler from
+// vectorizing them.
+#define READ_LOOP(Width, Full) \
+    do { \
+        const unsigned char *p = in; \
+        if (bits == 8) { \
+            int8_t *dst = out; \
+            for (size_t i = 0; i < count; i++, p += (Width)) \
+                dst[i] = (int8_t)((Full) >> 24); \
+        } else { \
+            int16_t *dst = out; \
+            for (size_t i = 0; i < count; i++, p += (Width)) \
+                dst[i] = (int16_t)((Full) >> 16); \
+        } \
+    } while (0) \
+    // end macro
+
+#define WRITE_LOOP(Width, Store) \
+    do { \
+        unsigned char *p = out; \
+        if (bits == 8) { \
+            const int8_t *src = in; \
+            for (size_t i = 0; i < count; i++, p += (Width)) { \
+                const int32_t full = (int32_t)((uint32_t)src[i] << 24); \
+                Store; \
+            } \
+        } else { \
+            const int16_t *src = in; \
+            for (size_t i = 0; i < count; i++, p += (Width)) { \
+                const int32_t full = (int32_t)((uint32_t)src[i] << 16); \
+                Store; \
+            } \
+        } \
+    } while (0) \
+    // end macro
+
+void format_read(const struct sample_format *f, unsigned bits, size_t count, const void *in, void *out)
+{
+    const bool big = f->big_endian;
+    const bool swap = big != HOST_BIG_ENDIAN;
+    switch (f->encoding) {
+        case FORMAT_U8 : READ_LOOP(1, (int32_t)((uint32_t)(p[0] ^ 0x80) << 24));     break;
+        case FORMAT_S8 : READ_LOOP(1, (int32_t)((uint32_t)p[0] << 24));              break;
+        case FORMAT_S16: READ_LOOP(2, (int32_t)((uint32_t)load16(p, swap) << 16));   break;
+        case FORMAT_S24:
+            if (big)
+                READ_LOOP(3, (int32_t)(load24be(p) << 8));
+            else
+                READ_LOOP(3, (int32_t)(load24le(p) << 8));
+            break;
+        case FORMAT_S32: READ_LOOP(4, (int32_t)load32(p, swap));                     break;
+        case FORMAT_F32: READ_LOOP(4, from_float(load32(p, swap)));                  break;
+        case FORMAT_max: break;
+    }
+}
+
+void format_write(const struct sample_format *f, unsigned bits, size_t count, const void *in, void *out)
+{
+    const bool big = f->big_endian;
+    const bool swap = big != HOST_BIG_ENDIAN;
+    switch (f->encoding) {
+        case FORMAT_U8 : WRITE_LOOP(1, p[0] = (unsigned char)((uint32_t)full >> 24 ^ 0x80));   break;
+        case FORMAT_S8 : WRITE_LOOP(1, p[0] = (unsigned char)((uint32_t)full >> 24));          break;
+        case FORMAT_S16: WRITE_LOOP(2, store16(p, (uint16_t)((uint32_t)full >> 16), swap));    break;
+        case FORMAT_S24: WRITE_LOOP(3, store24(p, (uint32_t)full >> 8, big));                  break;
+        case FORMAT_S32: WRITE_LOOP(4, store32(p, (uint32_t)full, swap));                      break;
+        case FORMAT_F32: WRITE_LOOP(4, store32(p, to_float(full), swap));                      break;
+        case FORMAT_max: break;
+    }
+}
+
+static int read_exactly(int fd, void *buf, size_t len)
+{
+    char *where = buf;
+    while (len > 0) {
+        const ssize_t result = read(fd, where, len);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return -1;
+        where += result;
+        len -= (size_t)result;
+    }
+
+    return 0;
+}
+
+static uint32_t le16(const unsigned char *p) { return (uint32_t)p[0] | (uint32_t)p[1] << 8; }
+static uint32_t le32(const unsigned char *p) { return le16(p) | le16(p + 2) << 16; }
+
+enum { WAV_PCM = 1, WAV_FLOAT = 3, WAV_EXTENSIBLE = 0xfffe };
+
+// The input may be a pipe, so chunks that are not needed are read and
+// thrown away rather than sought past.
+int wav_read_header(int fd, struct sample_format *f, const char **why)
+{
+    unsigned char buf[40];
+    if (read_exactly(fd, buf, 12) || memcmp(buf, "RIFF", 4) != 0 || memcmp(buf + 8, "WAVE", 4) != 0) {
+        *why = "not a WAV file";
+        return -1;
+    }
+
+    bool have_format = false;
+    while (true) {
+        if (read_exactly(fd, buf, 8)) {
+            *why = "no samples in WAV file";
+            return -1;
+        }
+
+        const bool is_format = memcmp(buf, "fmt ", 4) == 0;
+        const bool is_data = memcmp(buf, "data", 4) == 0;
+        uint32_t size = le32(buf + 4);
+        if (is_data) {
+            if (! have_format) {
+                *why = "WAV samples come before their format";
+                return -1;
+            }
+            return 0;
+        }
+
+        size += size & 1; // chunks are padded to an even length
+        if (is_format) {
+            const uint32_t len = size < sizeof buf ? size : sizeof buf;
+            if (len < 16 || read_exactly(fd, buf, len)) {
+                *why = "bad WAV format chunk";
+                return -1;
+            }
+            size -= len;
+
+            uint32_t tag = le16(buf);
+            if (tag == WAV_EXTENSIBLE && len >= 26)
+                tag = le16(buf + 24); // the start of the subformat GUID
+            const uint32_t bits = le16(buf + 14);
+
+            *f = (struct sample_format){
+                .wav = true,
+                .channels = le16(buf + 2),
+                .rate = le32(buf + 4),
+            };
+            if (tag == WAV_PCM && bits == 8)
+                f->encoding = FORMAT_U8;
+            else if (tag == WAV_PCM && bits == 16)
+                f->encoding = FORMAT_S16;
+            else if (tag == WAV_PCM && bits == 24)
+                f->encoding = FORMAT_S24;
+            else if (tag == WAV_PCM && bits == 32)
+                f->encoding = FORMAT_S32;
+            else if (tag == WAV_FLOAT && bits == 32)
+                f->encoding = FORMAT_F32;
+            else {
+                *why = "unsupported WAV sample format";
+                return -1;
+            }
+            have_format = true;
+        }
+
+        for (uint32_t len; size > 0; size -= len) {
+            len = size < sizeof buf ? size : sizeof buf;
+            if (read_exactly(fd, buf, len)) {
+                *why = "truncated WAV file";
+                return -1;
+            }
+        }
+    }
+}
+
+static void put16(unsigned char *p, uint32_t v) { p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); }
+static void put32(unsigned char *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+void wav_make_header(const struct sample_format *f, uint64_t data_bytes, unsigned char out[WAV_HEADER_SIZE])
+{
+    const uint32_t most = UINT32_MAX - (WAV_HEADER_SIZE - 8);
+    const uint32_t data = data_bytes > most ? most : (uint32_t)data_bytes;
+    const uint32_t width = (uint32_t)format_width(f);
+    const uint32_t channels = f->channels ? f->channels : 1;
+
+    memcpy(out, "RIFF", 4);
+    put32(out + 4, data + WAV_HEADER_SIZE - 8);
+    memcpy(out + 8, "WAVE", 4);
+    memcpy(out + 12, "fmt ", 4);
+    put32(out + 16, 16);
+    put16(out + 20, f->encoding == FORMAT_F32 ? WAV_FLOAT : WAV_PCM);
+    put16(out + 22, channels);
+    put32(out + 24, f->rate);
+    put32(out + 28, f->rate * channels * width);
+    put16(out + 32, channels * width);
+    put16(out + 34, width * CHAR_BIT);
+    memcpy(out + 36, "data", 4);
+    put32(out + 40, data);
+}
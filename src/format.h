@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef FORMAT_H_
+#define FORMAT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// How samples are stored outside the program. Inside, `gen` and `listen` work
+// on signed samples of 8 or 16 bits in host order; a sample_format converts
+// between those and what other tools read and write, so that audio needs no
+// conversion by another program on its way in or out.
+enum sample_encoding { FORMAT_U8, FORMAT_S8, FORMAT_S16, FORMAT_S24, FORMAT_S32, FORMAT_F32, FORMAT_max };
+
+struct sample_format {
+    enum sample_encoding encoding;
+    bool big_endian;
+    bool wav;           // framed by a WAV header
+    unsigned channels;  // from a WAV header, or zero if unknown
+    unsigned rate;      // likewise
+};
+
+// Parses a format name such as "s16", "s24be", "f32le", "u8" or "wav" (16-bit
+// WAV when writing; whatever the header says when reading). Samples of more
+// than 8 bits are in host order unless "le" or "be" says otherwise. Returns
+// nonzero if the name is not understood.
+int format_parse(const char *name, struct sample_format *f);
+
+// Returns the bytes in one stored sample
+size_t format_width(const struct sample_format *f);
+
+// Returns whether samples stored in `f` are already the internal samples
+// of `bits` bits, so that no conversion is needed
+bool format_is_native(const struct sample_format *f, unsigned bits);
+
+// Converts `count` samples stored in `f` into internal samples of `bits` bits
+void format_read(const struct sample_format *f, unsigned bits, size_t count, const void *in, void *out);
+
+// Converts `count` internal samples of `bits` bits into `f`
+void format_write(const struct sample_format *f, unsigned bits, size_t count, const void *in, void *out);
+
+// Reads a WAV header from `fd`, up to the start of the samples, filling in
+// `f`. Returns nonzero, with a message in `why`, if it cannot be used.
+int wav_read_header(int fd, struct sample_format *f, const char **why);
+
+enum { WAV_HEADER_SIZE = 44 };
+
+// Makes a WAV header for `data_bytes` bytes of samples in `f` (as many as
+// will fit, if the length is not known in advance)
+void wav_make_header(const struct sample_format *f, uint64_t data_bytes, unsigned char out[WAV_HEADER_SIZE]);
+
+#endif
@@ -23,31 +23,139 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "encode.h"
+#include "format.h"
+#include "profile.h"
 #include "sine.h"
 #include "state.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <unistd.h>
 
 typedef int DATA_TYPE;
 
+// samples synthesized per call to an encode_filler
+enum { BLOCK_SAMPLES = 4096 };
+// output blocks gathered into each writev()
+enum { SINK_BLOCKS = 16 };
+// input bytes read at a time
+enum { SOURCE_CHUNK = 65536 };
+
+// Input bytes, read from the stream a chunk at a time
+struct source {
+    FILE *stream;
+    size_t pos, len;
+    char buf[SOURCE_CHUNK];
+};
+
+// Where samples go, converted to the output format on the way if need be
+struct output {
+    int fd;
+    unsigned bits;
+    const struct sample_format *format; // unless samples go out as they are
+    uint64_t bytes;                     // written after any header
+    unsigned char *converted;           // BLOCK_SAMPLES of the output format
+};
+
+// Output samples, collected into page-aligned blocks that are written out
+// together
+struct sink {
+    struct output *out;
+    size_t width;   // bytes per sample
+    size_t used;    // samples in the current block
+    int block;      // index of the current block
+    char *blocks;
+    struct iovec iov[SINK_BLOCKS];
+};
+
 struct gen_state {
+    const MODEM_PROFILE *profile;
     SERIAL_CONFIG serial;
     BYTE_STATE byte_state;
     float gain;
+};
+
+// The output may interleave several lines (channels, in the audio sense),
+// each with its own transmitter, and optionally a second one answering on
+// the other modem channel, for full-duplex loopback.
+enum { MAX_LINES = 32 };
+
+struct line {
+    struct gen_state s;
+    FILE *input;
+    FILE *reply;    // for the answering transmitter, or NULL
+    int16_t sines[WAVE_TABLE_SIZE]; // wide enough for any ENCODE_BITS
+};
+
+struct options {
+    uint8_t bits;
     bool realtime;
+    unsigned threads;
+    unsigned lines;
+    FILE *output_stream;
+    FILE *timestamps;
+    struct sample_format format;
+    bool have_format;           // whether -f gave one
+    struct line dflt;            // for lines not named by -L
+    struct line line[MAX_LINES];
+    bool named[MAX_LINES];       // whether line[i] was named by -L
+};
+
+enum stage { LEAD, DATA, TRAIL, DRAIN, DONE };
+
+// One transmission: carrier padding, then the input, then more padding, as
+// a sequence of samples that can be taken a block at a time
+struct transmitter {
+    struct gen_state s;
+    struct source *in;
+    encode_filler *fill_bytes, *fill_carrier;
+    size_t width;           // bytes per sample
+    size_t padding;         // words of carrier on each end
+    size_t words;           // words of carrier sent so far in this stage
+    enum stage stage;
+    char ch;                // the byte being offered, in stage DATA
+    uint64_t produced;      // samples written so far
+    FILE *timestamps;       // if set, where to note when bytes are sent
+    unsigned line;
+    bool queued;            // whether a byte waits in the encoder to be sent
+    char next;              // the byte that waits
+};
+
+// A parallel encoding of a whole input, into a mapped output file
+struct job {
+    const struct gen_state *s;
+    encode_framer *frame_bytes, *frame_carrier;
+    const char *data;
+    size_t padding, bytes;  // words of carrier on each end, and of data
+    size_t samples;         // total samples to produce
+    size_t width;           // bytes per sample
+    char *map;
+};
+
+// The share of a job done by one thread, covering words [first, last)
+struct chunk {
+    const struct job *job;
+    size_t first, last;
+    size_t start;           // index of the first sample
+    char *out;              // NULL when only advancing the phase
+    size_t limit;           // samples that may be written to `out`
+    BYTE_STATE state;
 };
 
 static FILE *open_file(const char *filename, const char *mode, FILE *dflt)
@@ -58,10 +166,15 @@ static FILE *open_file(const char *filename, const char *mode, FILE *dflt)
     return fopen(filename, mode);
 }
 
-static int parse_opts(struct gen_state *s, int argc, char *argv[], uint8_t *bits, FILE **input_stream, FILE **output_stream)
+// Options that come before the first -L apply to every line; after -L N,
+// options describing a line apply to line N alone.
+static int parse_opts(struct options *o, int argc, char *argv[])
 {
+    struct line *l = &o->dflt;
+    struct gen_state *s = &l->s;
+    unsigned long n;
     int ch;
-    while ((ch = getopt(argc, argv, "C:G:T:P:D:p:b:m:F:o:r:")) != -1) {
+    while ((ch = getopt(argc, argv, "C:G:T:P:D:p:M:b:m:F:x:o:f:t:r:j:N:L:")) != -1) {
         switch (ch) {
             case 'C': s->byte_state.channel = strtol(optarg, NULL, 0);                 break;
             case 'G': s->gain               = strtof(optarg, NULL);                    break;
@@ -69,11 +182,41 @@ static int parse_opts(struct gen_state *s, int argc, char *argv[], uint8_t *bits
             case 'P': s->serial.parity_bits = strtol(optarg, NULL, 0);                 break;
             case 'D': s->serial.data_bits   = strtol(optarg, NULL, 0);                 break;
             case 'p': s->serial.parity      = strtol(optarg, NULL, 0);                 break;
-            case 'b': *bits                 = strtol(optarg, NULL, 0);                 break;
-            case 'm': *input_stream         = fmemopen(optarg, strlen(optarg), "r");   break;
-            case 'F': *input_stream         = open_file(optarg, "r", stdin );          break;
-            case 'o': *output_stream        = open_file(optarg, "w", stdout);          break;
-            case 'r': s->realtime           = strtol(optarg, NULL, 0);                 break;
+            case 'M': s->profile            = find_profile(optarg);                    break;
+            case 'm': l->input              = fmemopen(optarg, strlen(optarg), "r");   break;
+            case 'F': l->input              = open_file(optarg, "r", stdin );          break;
+            case 'x': l->reply              = open_file(optarg, "r", stdin );          break;
+            case 'b': o->bits               = strtol(optarg, NULL, 0);                 break;
+            case 'o': o->output_stream      = open_file(optarg, "w+", stdout);         break;
+            case 'r': o->realtime           = strtol(optarg, NULL, 0);                 break;
+            case 'j': o->threads            = strtol(optarg, NULL, 0);                 break;
+            case 'N': o->lines              = strtoul(optarg, NULL, 0);                break;
+            case 't':
+                o->timestamps = open_file(optarg, "w", stdout);
+                if (! o->timestamps) {
+                    fprintf(stderr, "Failed to open %s : %s\n", optarg, strerror(errno));
+                    return -1;
+                }
+                break;
+            case 'f':
+                if (format_parse(optarg, &o->format)) {
+                    fprintf(stderr, "Unknown sample format %s\n", optarg);
+                    return -1;
+                }
+                o->have_format = true;
+                break;
+            case 'L':
+                n = strtoul(optarg, NULL, 0);
+                if (n >= MAX_LINES) {
+                    fprintf(stderr, "Line number must be less than %d\n", MAX_LINES);
+                    return -1;
+                }
+                if (! o->named[n])
+                    o->line[n] = o->dflt;
+                o->named[n] = true;
+                l = &o->line[n];
+                s = &l->s;
+                break;
 
             default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
         }
@@ -82,81 +225,605 @@ static int parse_opts(struct gen_state *s, int argc, char *argv[], uint8_t *bits
     return 0;
 }
 
+static bool next_byte(struct source *in, char *ch)
+{
+    if (in->pos == in->len) {
+        in->pos = 0;
+        in->len = fread(in->buf, 1, sizeof in->buf, in->stream);
+        if (in->len == 0) {
+            if (ferror(in->stream)) {
+                fprintf(stderr, "Failed to read input : %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            return false;
+        }
+    }
+
+    *ch = in->buf[in->pos++];
+    return true;
+}
+
+static void write_fully(int fd, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t result = writev(fd, iov, count);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Failed to write output : %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        // skip whatever was written, which may end partway through a block
+        size_t done = (size_t)result;
+        while (count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+}
+
+// Writes `count` blocks of samples, in the output format
+static void write_samples(struct output *o, struct iovec *iov, int count)
+{
+    if (! o->format) {
+        for (int i = 0; i < count; i++)
+            o->bytes += iov[i].iov_len;
+        write_fully(o->fd, iov, count);
+        return;
+    }
+
+    const size_t width = o->bits / CHAR_BIT;
+    const size_t stored = format_width(o->format);
+    for (int i = 0; i < count; i++) {
+        const char *in = iov[i].iov_base;
+        for (size_t left = iov[i].iov_len / width; left > 0; ) {
+            const size_t n = left < BLOCK_SAMPLES ? left : BLOCK_SAMPLES;
+            format_write(o->format, o->bits, n, in, o->converted);
+            struct iovec out = { o->converted, n * stored };
+            write_fully(o->fd, &out, 1);
+            o->bytes += n * stored;
+            in += n * width;
+            left -= n;
+        }
+    }
+}
+
+static void write_wav_header(struct output *o, const struct sample_format *f, uint64_t data_bytes)
+{
+    unsigned char header[WAV_HEADER_SIZE];
+    wav_make_header(f, data_bytes, header);
+    struct iovec iov = { header, sizeof header };
+    write_fully(o->fd, &iov, 1);
+}
+
+// A WAV header written before the length was known claims as many samples
+// as it can hold; if the output can be rewritten, the header is made exact.
+static void finish_output(struct output *o, const struct sample_format *wav)
+{
+    if (wav && lseek(o->fd, 0, SEEK_SET) == 0)
+        write_wav_header(o, wav, o->bytes);
+    free(o->converted);
+}
+
+static void sink_init(struct sink *k, struct output *out, size_t width)
+{
+    const size_t page = 4096;
+    *k = (struct sink){ .out = out, .width = width };
+    k->blocks = aligned_alloc(page, SINK_BLOCKS * BLOCK_SAMPLES * sizeof(int16_t));
+    if (! k->blocks) {
+        fprintf(stderr, "Failed to allocate output buffer\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void sink_flush(struct sink *k)
+{
+    const size_t size = BLOCK_SAMPLES * k->width;
+    for (int i = 0; i < k->block; i++)
+        k->iov[i] = (struct iovec){ k->blocks + i * size, size };
+
+    int count = k->block;
+    if (k->used > 0)
+        k->iov[count++] = (struct iovec){ k->blocks + k->block * size, k->used * k->width };
+
+    write_samples(k->out, k->iov, count);
+    k->block = 0;
+    k->used = 0;
+}
+
+// returns where the next samples go, and how many of them fit there
+static void *sink_space(struct sink *k, size_t *count)
+{
+    *count = BLOCK_SAMPLES - k->used;
+    return k->blocks + (k->block * BLOCK_SAMPLES + k->used) * k->width;
+}
+
+static void sink_commit(struct sink *k, size_t count)
+{
+    k->used += count;
+    if (k->used == BLOCK_SAMPLES) {
+        k->used = 0;
+        if (++k->block == SINK_BLOCKS)
+            sink_flush(k);
+    }
+}
+
+static size_t frame_word(const struct job *j, BYTE_STATE *b, size_t i, size_t count, void *out)
+{
+    const struct gen_state *s = j->s;
+    if (i < j->padding || i >= j->padding + j->bytes)
+        return j->frame_carrier(&s->serial, b, s->byte_state.channel, 0, count, out);
+    else
+        return j->frame_bytes(&s->serial, b, s->byte_state.channel, j->data[i - j->padding], count, out);
+}
+
+static void *encode_chunk(void *arg)
+{
+    struct chunk *c = arg;
+    const size_t width = c->job->width;
+    char *out = c->out;
+    size_t left = c->limit;
+
+    for (size_t i = c->first; i < c->last && left > 0; i++) {
+        size_t n = frame_word(c->job, &c->state, i, left, out);
+        if (out)
+            out += n * width;
+        left -= n;
+    }
+
+    return NULL;
+}
+
+static void run_chunks(unsigned count, struct chunk chunks[count])
+{
+    pthread_t threads[count];
+    for (unsigned t = 1; t < count; t++) {
+        int rc = pthread_create(&threads[t], NULL, encode_chunk, &chunks[t]);
+        if (rc) {
+            fprintf(stderr, "Failed to start thread : %s\n", strerror(rc));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    encode_chunk(&chunks[0]);
+
+    for (unsigned t = 1; t < count; t++)
+        pthread_join(threads[t], NULL);
+}
+
+static char *read_all(FILE *stream, size_t *size)
+{
+    char *data = NULL;
+    size_t have = 0, got = 0;
+    do {
+        have += got;
+        data = realloc(data, have + SOURCE_CHUNK);
+        if (! data) {
+            fprintf(stderr, "Failed to allocate input buffer\n");
+            exit(EXIT_FAILURE);
+        }
+    } while ((got = fread(data + have, 1, SOURCE_CHUNK, stream)) > 0);
+
+    if (ferror(stream)) {
+        fprintf(stderr, "Failed to read input : %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    *size = have;
+    return data;
+}
+
+// Produces the same output as the streaming encoder, split across threads.
+// Every word after the first is accepted while its predecessor is still
+// being sent, so the bits run back-to-back from the first sample, and where
+// each word starts follows from the fractional bit clock alone. The phase
+// at each chunk boundary is the sum of the phase steps of all the samples
+// before it; each thread finds the sum for its own chunk (without
+// synthesizing anything), and a prefix sum of those gives the start phases.
+static void encode_parallel(const struct gen_state *s, unsigned threads, encode_framer *frame_bytes, encode_framer *frame_carrier, size_t width, FILE *input_stream, FILE *output_stream)
+{
+    struct job job = {
+        .s = s,
+        .frame_bytes = frame_bytes,
+        .frame_carrier = frame_carrier,
+        .width = width,
+    };
+
+    char *data = read_all(input_stream, &job.bytes);
+    job.data = data;
+
+    const uint64_t bit_count = NUM_START_BITS + s->serial.data_bits + s->serial.parity_bits + s->serial.stop_bits;
+    const uint64_t bit_period = s->byte_state.bit_state.bit_period;
+    job.padding = s->profile->baud_rate / bit_count;
+
+    const size_t words = 2 * job.padding + job.bytes;
+    if (words < 2) {
+        fprintf(stderr, "Too little to encode\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The streaming encoder stops just before the sample at which it would
+    // accept one more word, which is the one after the start of the last
+    // bit of the next-to-last word.
+    job.samples = (size_t)((((words - 1) * bit_count - 1) * bit_period) >> BIT_CLOCK_FRACTION_BITS) + 1;
+
+    int fd = fileno(output_stream);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ! S_ISREG(st.st_mode)) {
+        fprintf(stderr, "Parallel encoding needs a regular output file (see -o)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const size_t size = job.samples * width;
+    if (ftruncate(fd, (off_t)size) != 0) {
+        fprintf(stderr, "Failed to size output file : %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    job.map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (job.map == MAP_FAILED) {
+        // the file has to be open for reading, too, which `-o` ensures
+        fprintf(stderr, "Failed to map output file : %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    const unsigned count = threads < words ? threads : (unsigned)words;
+    struct chunk chunks[count];
+    for (unsigned t = 0; t < count; t++) {
+        struct chunk *c = &chunks[t];
+        *c = (struct chunk){
+            .job = &job,
+            .first = words * t / count,
+            .last = words * (t + 1) / count,
+            .limit = SIZE_MAX,
+            .state = s->byte_state,
+        };
+
+        const uint64_t clock = c->first * bit_count * bit_period;
+        c->start = (size_t)(clock >> BIT_CLOCK_FRACTION_BITS);
+        c->state.bit_state.clock = clock & (BIT_CLOCK_ONE - 1);
+        c->state.bit_state.sample_state.phase = 0;
+    }
+
+    // First find how far each chunk advances the phase
+    run_chunks(count, chunks);
+
+    PHASE_TYPE phase = s->byte_state.bit_state.sample_state.phase;
+    for (unsigned t = 0; t < count; t++) {
+        struct chunk *c = &chunks[t];
+        const PHASE_TYPE advance = c->state.bit_state.sample_state.phase;
+
+        c->state = s->byte_state;
+        c->state.bit_state.clock = (c->first * bit_count * bit_period) & (BIT_CLOCK_ONE - 1);
+        c->state.bit_state.sample_state.phase = phase;
+        c->out = job.map + c->start * width;
+        c->limit = c->start < job.samples ? job.samples - c->start : 0;
+
+        phase = (PHASE_TYPE)(phase + advance);
+    }
+
+    // Then synthesize every chunk from its own starting point
+    run_chunks(count, chunks);
+
+    munmap(job.map, size);
+    free(data);
+}
+
+static void transmitter_init(struct transmitter *t, const struct gen_state *s, FILE *input, encode_filler *fill_bytes, encode_filler *fill_carrier, size_t width)
+{
+    *t = (struct transmitter){
+        .s = *s,
+        .fill_bytes = fill_bytes,
+        .fill_carrier = fill_carrier,
+        .width = width,
+        .stage = LEAD,
+    };
+
+    t->in = malloc(sizeof *t->in);
+    if (! t->in) {
+        fprintf(stderr, "Failed to allocate input buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    t->in->stream = input;
+    t->in->pos = t->in->len = 0;
+
+    // Pad with about a second of carrier on each end
+    t->padding = s->profile->baud_rate / (NUM_START_BITS + s->serial.data_bits + s->serial.parity_bits + s->serial.stop_bits);
+}
+
+// The encoder holds one word while it sends another, so a byte is accepted
+// a word before it is sent, and starts going out when the word after it is
+// accepted. That sample, the first of its start bit, is the one that
+// `listen -t` is timed against; `offset` places it within this call.
+static void note_start(struct transmitter *t, size_t offset)
+{
+    if (t->queued && t->timestamps)
+        fprintf(t->timestamps, "%u %d %" PRIu64 " %u\n", t->line, t->s.byte_state.channel, t->produced + offset, (unsigned char)t->next);
+    t->queued = false;
+}
+
+// Writes up to `count` samples of the transmission to `out`, returning how
+// many were written; fewer than `count` means that the transmission is over.
+// The encoder is drained at the end, leaving off the sample that accepted
+// the last word.
+static size_t transmit(struct transmitter *t, size_t count, char *out)
+{
+    struct gen_state *s = &t->s;
+    const enum channel channel = s->byte_state.channel;
+    size_t done = 0;
+
+    while (done < count && t->stage != DONE) {
+        if ((t->stage == LEAD || t->stage == TRAIL) && t->words == t->padding) {
+            t->words = 0;
+            t->stage = t->stage == TRAIL ? DRAIN : next_byte(t->in, &t->ch) ? DATA : TRAIL;
+            continue;
+        }
+
+        bool accepted = false;
+        void *where = out + done * t->width;
+        size_t n = 0;
+        switch (t->stage) {
+            case LEAD:
+            case TRAIL:
+                n = t->fill_carrier(&s->serial, &s->byte_state, true, channel, 0, &accepted, count - done, where);
+                if (accepted) {
+                    note_start(t, done + n - 1);
+                    t->words++;
+                }
+                break;
+            case DATA:
+                n = t->fill_bytes(&s->serial, &s->byte_state, true, channel, t->ch, &accepted, count - done, where);
+                if (accepted) {
+                    note_start(t, done + n - 1);
+                    t->queued = true;
+                    t->next = t->ch;
+                }
+                if (accepted && ! next_byte(t->in, &t->ch))
+                    t->stage = TRAIL;
+                break;
+            case DRAIN:
+                n = t->fill_carrier(&s->serial, &s->byte_state, true, channel, 0, &accepted, count - done, where);
+                if (accepted) {
+                    n--;
+                    t->stage = DONE;
+                }
+                break;
+            case DONE:
+                break;
+        }
+
+        done += n;
+    }
+
+    t->produced += done;
+    return done;
+}
+
+// Adds `frames` samples from `lane` into every `stride`th sample of `frame`,
+// saturating, so that two transmitters can share a line.
+static void mix(size_t width, size_t frames, unsigned stride, const char *lane, char *frame)
+{
+    if (width == sizeof(int16_t)) {
+        const int16_t *in = (const int16_t*)lane;
+        int16_t *out = (int16_t*)frame;
+        for (size_t f = 0; f < frames; f++) {
+            const int sum = out[f * stride] + in[f];
+            out[f * stride] = (int16_t)(sum > INT16_MAX ? INT16_MAX : sum < INT16_MIN ? INT16_MIN : sum);
+        }
+    } else {
+        const int8_t *in = (const int8_t*)lane;
+        int8_t *out = (int8_t*)frame;
+        for (size_t f = 0; f < frames; f++) {
+            const int sum = out[f * stride] + in[f];
+            out[f * stride] = (int8_t)(sum > INT8_MAX ? INT8_MAX : sum < INT8_MIN ? INT8_MIN : sum);
+        }
+    }
+}
+
+// Runs every transmitter a block at a time into its own lane, and
+// interleaves the lanes (mixing those that share a line) into frames of
+// `lines` samples, until all of the transmissions are over. Lines whose
+// transmissions end early carry silence.
+static void transmit_lines(unsigned count, struct transmitter tx[count], const unsigned line_of[count], unsigned lines, struct output *out)
+{
+    const size_t width = tx[0].width;
+    char *lanes = malloc(count * BLOCK_SAMPLES * width);
+    char *frames = malloc(lines * BLOCK_SAMPLES * width);
+    if (! lanes || ! frames) {
+        fprintf(stderr, "Failed to allocate output buffers\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (true) {
+        size_t longest = 0;
+        for (unsigned t = 0; t < count; t++) {
+            char *lane = lanes + t * BLOCK_SAMPLES * width;
+            const size_t n = transmit(&tx[t], BLOCK_SAMPLES, lane);
+            memset(lane + n * width, 0, (BLOCK_SAMPLES - n) * width);
+            longest = n > longest ? n : longest;
+        }
+
+        if (longest == 0)
+            break;
+
+        memset(frames, 0, lines * longest * width);
+        for (unsigned t = 0; t < count; t++)
+            mix(width, longest, lines, lanes + t * BLOCK_SAMPLES * width, frames + line_of[t] * width);
+
+        struct iovec iov = { frames, lines * longest * width };
+        write_samples(out, &iov, 1);
+    }
+
+    free(frames);
+    free(lanes);
+}
+
 static void null_handler(int ignored)
 {
     (void)ignored;
 }
 
-sines_init init_sines8;
-sines_init init_sines16;
+sines_fill fill_sines8;
+sines_fill fill_sines16;
+
+profile_init init_profile8;
+profile_init init_profile16;
 
 encode_pusher encode_bytes8, encode_carrier8;
 encode_pusher encode_bytes16, encode_carrier16;
 
+encode_filler encode_bytes_block8, encode_carrier_block8;
+encode_filler encode_bytes_block16, encode_carrier_block16;
+
+encode_framer encode_bytes_frame8, encode_carrier_frame8;
+encode_framer encode_bytes_frame16, encode_carrier_frame16;
+
 // returns zero on failure
 int main(int argc, char* argv[])
 {
-    struct gen_state _s = {
-        .serial = {
-            .data_bits   = 8,
-            .parity_bits = 0,
-            .stop_bits   = 2,
+    static struct options opts = {
+        .bits  = 16,
+        .lines = 1,
+        .dflt  = {
+            .s = {
+                .serial = {
+                    .data_bits   = 8,
+                    .parity_bits = 0,
+                    .stop_bits   = 2,
+                },
+                .byte_state = {
+                    .channel = 0,
+                },
+                .gain      = 0.5,
+            },
         },
-        .byte_state = {
-            .channel = 0,
-        },
-        .gain      = 0.5,
-    }, *s = &_s;
+    };
 
-    FILE *input_stream = stdin;
-    FILE *output_stream = stdout;
-    uint8_t bits = 16;
-    int rc = parse_opts(s, argc, argv, &bits, &input_stream, &output_stream);
+    opts.dflt.s.profile = find_profile("bell103");
+    opts.dflt.input = stdin;
+    opts.output_stream = stdout;
+    int rc = parse_opts(&opts, argc, argv);
     if (rc)
         return rc;
 
     struct {
-        encode_pusher *bytes, *carrier;
-        sines_init *sines;
+        encode_pusher *bytes;
+        encode_filler *fill_bytes, *fill_carrier;
+        encode_framer *frame_bytes, *frame_carrier;
+        sines_fill *sines;
+        profile_init *profile;
     } encoders[] = {
-        [8]  = { encode_bytes8 , encode_carrier8 , init_sines8  },
-        [16] = { encode_bytes16, encode_carrier16, init_sines16 },
+        [8]  = { encode_bytes8 , encode_bytes_block8 , encode_carrier_block8 , encode_bytes_frame8 , encode_carrier_frame8 , fill_sines8 , init_profile8  },
+        [16] = { encode_bytes16, encode_bytes_block16, encode_carrier_block16, encode_bytes_frame16, encode_carrier_frame16, fill_sines16, init_profile16 },
     };
 
+    const uint8_t bits = opts.bits;
     if (bits >= sizeof(encoders) / sizeof(encoders[0]) || ! encoders[bits].bytes) {
         fprintf(stderr, "No encoder found for bits=%d\n", bits);
         exit(EXIT_FAILURE);
     }
 
     encode_pusher *encode_bytes = encoders[bits].bytes;
-    encode_pusher *encode_carrier = encoders[bits].carrier;
-    sines_init *init_sines = encoders[bits].sines;
+    encode_filler *fill_bytes = encoders[bits].fill_bytes;
+    encode_filler *fill_carrier = encoders[bits].fill_carrier;
+    sines_fill *fill_sines = encoders[bits].sines;
+    profile_init *init_profile = encoders[bits].profile;
+    const size_t width = bits / CHAR_BIT;
 
-    if (! input_stream) {
-        fprintf(stderr, "Failed to open input stream : %s\n", strerror(errno));
+    FILE *output_stream = opts.output_stream;
+    if (! output_stream) {
+        fprintf(stderr, "Failed to open output stream : %s\n", strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    if (! output_stream) {
-        fprintf(stderr, "Failed to open output stream : %s\n", strerror(errno));
+    const unsigned count = opts.lines;
+    if (count < 1 || count > MAX_LINES) {
+        fprintf(stderr, "Number of lines must be between 1 and %d\n", MAX_LINES);
         exit(EXIT_FAILURE);
     }
 
-    if (s->byte_state.channel > 1) {
-        fprintf(stderr, "Invalid channel %d\n", s->byte_state.channel);
-        return -1;
+    for (unsigned i = count; i < MAX_LINES; i++) {
+        if (opts.named[i]) {
+            fprintf(stderr, "Line %u is not in the output (see -N)\n", i);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    init_sines(&s->byte_state.bit_state.sample_state.quadrant, s->gain);
+    for (unsigned i = 0; i < count; i++) {
+        struct line *l = &opts.line[i];
+        if (! opts.named[i])
+            *l = opts.dflt;
+
+        if (! l->input) {
+            fprintf(stderr, "Failed to open input stream : %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if (l->s.byte_state.channel > 1) {
+            fprintf(stderr, "Invalid channel %d\n", l->s.byte_state.channel);
+            return -1;
+        }
+
+        if (! l->s.profile) {
+            fprintf(stderr, "Unknown modem profile\n");
+            return -1;
+        }
+
+        fill_sines(l->sines, l->s.gain);
+        l->s.byte_state.bit_state.sample_state.quadrant = l->sines;
+        init_profile(&l->s.byte_state, l->s.profile);
+    }
+
+    struct gen_state *s = &opts.line[0].s;
+    FILE *input_stream = opts.line[0].input;
+    const bool single = count == 1 && ! opts.line[0].reply;
+
+    if (! single && (opts.realtime || opts.threads > 0)) {
+        fprintf(stderr, "Realtime and parallel encoding take a single line\n");
+        exit(EXIT_FAILURE);
+    }
 
-    if (s->realtime) {
+    struct output output = { .fd = fileno(output_stream), .bits = bits };
+    const struct sample_format *wav = NULL;
+    if (opts.have_format) {
+        opts.format.channels = count;
+        opts.format.rate = SAMPLE_RATE;
+        if (opts.format.wav)
+            wav = &opts.format;
+        if (! format_is_native(&opts.format, bits)) {
+            output.format = &opts.format;
+            output.converted = malloc(BLOCK_SAMPLES * format_width(&opts.format));
+            if (! output.converted) {
+                fprintf(stderr, "Failed to allocate output buffer\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    if ((opts.realtime || opts.threads > 0) && opts.timestamps) {
+        fprintf(stderr, "Timestamps come only from streaming encoding\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts.threads > 0 && (wav || output.format)) {
+        fprintf(stderr, "Parallel encoding writes only raw samples of -b bits\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (wav)
+        write_wav_header(&output, wav, UINT64_MAX);
+
+    if (opts.realtime) {
         int input_fd = fileno(input_stream);
         struct timeval tv = { .tv_usec = 1.0 / SAMPLE_RATE * 1000000 };
         struct itimerval it = { .it_interval = tv, .it_value = tv };
 
-        // Do not buffer output at all
-        setvbuf(stdout, NULL, _IONBF, 0);
-
         // Ignore SIGALRM except to wake us up
         signal(SIGALRM, null_handler);
 
@@ -193,39 +860,87 @@ int main(int argc, char* argv[])
             if (result < 0)
                 break;
 
-            fwrite(&out, bits / CHAR_BIT, 1, output_stream);
-        }
-    } else {
-        for (size_t i = 0; i < SAMPLES_PER_BIT; /* incremented inside loop */) {
-            DATA_TYPE out = 0;
-            if (encode_carrier(&s->serial, &s->byte_state, true, s->byte_state.channel, 0, &out))
-                i++;
-            fwrite(&out, bits / CHAR_BIT, 1, output_stream);
+            // Each sample goes out as soon as it is made
+            struct iovec iov = { &out, bits / CHAR_BIT };
+            write_samples(&output, &iov, 1);
         }
 
-        char ch = 0;
-        rc = fread(&ch, 1, 1, input_stream);
-        while (! feof(input_stream)) {
-            DATA_TYPE out = 0;
-            if (encode_bytes(&s->serial, &s->byte_state, true, s->byte_state.channel, ch, &out))
-                rc = fread(&ch, 1, 1, input_stream);
-            fwrite(&out, bits / CHAR_BIT, 1, output_stream);
+        // drain the encoder, leaving off the sample that accepted the last word
+        int16_t block[BLOCK_SAMPLES];
+        bool accepted = false;
+        while (! accepted) {
+            size_t n = fill_carrier(&s->serial, &s->byte_state, true, s->byte_state.channel, 0, &accepted, BLOCK_SAMPLES, block);
+            struct iovec iov = { block, (n - accepted) * width };
+            write_samples(&output, &iov, 1);
         }
 
-        for (size_t i = 0; i < SAMPLES_PER_BIT; /* incremented inside loop */) {
-            DATA_TYPE out = 0;
-            if (encode_carrier(&s->serial, &s->byte_state, true, s->byte_state.channel, 0, &out))
-                i++;
-            fwrite(&out, bits / CHAR_BIT, 1, output_stream);
+        finish_output(&output, wav);
+        return 0;
+    }
+
+    if (opts.threads > 0) {
+        encode_parallel(s, opts.threads, encoders[bits].frame_bytes, encoders[bits].frame_carrier, width, input_stream, output_stream);
+        return 0;
+    }
+
+    if (single) {
+        struct transmitter t;
+        transmitter_init(&t, s, input_stream, fill_bytes, fill_carrier, width);
+        t.timestamps = opts.timestamps;
+
+        struct sink out;
+        sink_init(&out, &output, width);
+
+        while (t.stage != DONE) {
+            size_t space = 0;
+            void *where = sink_space(&out, &space);
+            sink_commit(&out, transmit(&t, space, where));
         }
+
+        sink_flush(&out);
+        finish_output(&output, wav);
+        free(out.blocks);
+        free(t.in);
+
+        return 0;
     }
 
-    // drain the encoder
-    {
-        DATA_TYPE out = 0;
-        while (! encode_carrier(&s->serial, &s->byte_state, true, s->byte_state.channel, 0, &out))
-            fwrite(&out, bits / CHAR_BIT, 1, output_stream);
+    // a transmitter for every line, and another for every reply
+    struct transmitter tx[2 * MAX_LINES];
+    unsigned line_of[2 * MAX_LINES];
+    unsigned n = 0;
+    for (unsigned i = 0; i < count; i++) {
+        const struct line *l = &opts.line[i];
+        struct gen_state answer = l->s;
+        answer.byte_state.channel = l->s.byte_state.channel == CHAN_ZERO ? CHAN_ONE : CHAN_ZERO;
+
+        const struct { const struct gen_state *s; FILE *input; } sides[] = {
+            { &l->s, l->input },
+            { &answer, l->reply },
+        };
+
+        for (int side = 0; side < 2 && sides[side].input; side++) {
+            // Lines named by -L inherit the inputs given before it, which
+            // would then be split between them.
+            for (unsigned t = 0; t < n; t++) {
+                if (tx[t].in->stream == sides[side].input) {
+                    fprintf(stderr, "Lines %u and %u share an input (see -F and -x)\n", line_of[t], i);
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            line_of[n] = i;
+            transmitter_init(&tx[n], sides[side].s, sides[side].input, fill_bytes, fill_carrier, width);
+            tx[n].timestamps = opts.timestamps;
+            tx[n++].line = i;
+        }
     }
 
+    transmit_lines(n, tx, line_of, count, &output);
+    finish_output(&output, wav);
+
+    for (unsigned t = 0; t < n; t++)
+        free(tx[t].in);
+
     return 0;
 }
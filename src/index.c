@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "index.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Each sums at most a block of frames at a time, so 32 bits are plenty. A
+// single line, the common case, gets a loop simple enough for the compiler
+// to vectorize.
+void index_envelope8(size_t frames, size_t lines, const int8_t in[], uint32_t sums[])
+{
+    if (lines == 1) {
+        uint32_t sum = 0;
+        for (size_t i = 0; i < frames; i++)
+            sum += (uint32_t)(in[i] < 0 ? -in[i] : in[i]);
+        sums[0] += sum;
+        return;
+    }
+
+    for (size_t f = 0; f < frames; f++, in += lines)
+        for (size_t l = 0; l < lines; l++)
+            sums[l] += (uint32_t)(in[l] < 0 ? -in[l] : in[l]);
+}
+
+void index_envelope16(size_t frames, size_t lines, const int16_t in[], uint32_t sums[])
+{
+    if (lines == 1) {
+        uint32_t sum = 0;
+        for (size_t i = 0; i < frames; i++)
+            sum += (uint32_t)(in[i] < 0 ? -in[i] : in[i]);
+        sums[0] += sum;
+        return;
+    }
+
+    for (size_t f = 0; f < frames; f++, in += lines)
+        for (size_t l = 0; l < lines; l++)
+            sums[l] += (uint32_t)(in[l] < 0 ? -in[l] : in[l]);
+}
+
+int index_add(struct carrier_index *idx, uint64_t start, uint64_t end)
+{
+    if (idx->count && start <= idx->regions[idx->count - 1].end + (uint64_t)INDEX_GAP * INDEX_BLOCK) {
+        struct region *last = &idx->regions[idx->count - 1];
+        if (end > last->end)
+            last->end = end;
+        return 0;
+    }
+
+    if (idx->count == idx->capacity) {
+        const size_t capacity = idx->capacity ? 2 * idx->capacity : 64;
+        struct region *regions = realloc(idx->regions, capacity * sizeof *regions);
+        if (! regions)
+            return -1;
+        idx->regions = regions;
+        idx->capacity = capacity;
+    }
+
+    idx->regions[idx->count++] = (struct region){ start, end };
+    return 0;
+}
+
+uint64_t index_frames(const struct carrier_index *idx)
+{
+    uint64_t frames = 0;
+    for (size_t i = 0; i < idx->count; i++)
+        frames += idx->regions[i].end - idx->regions[i].start;
+
+    return frames;
+}
+
+static const char signature[] = "tynsel-index 2";
+
+int index_save(const char *path, const struct carrier_index *idx)
+{
+    FILE *f = fopen(path, "w");
+    if (! f)
+        return -1;
+
+    fprintf(f, "%s size %" PRIu64 " mtime %" PRId64 " data %" PRIu64 " frame %" PRIu32 " lines %" PRIu32
+            " encoding %" PRIu32 " big-endian %" PRIu32 " bits %" PRIu32 " threshold %" PRIu32 " regions %zu\n",
+            signature, idx->size, idx->mtime, idx->data, idx->frame, idx->lines,
+            idx->encoding, idx->big_endian, idx->bits, idx->threshold, idx->count);
+    for (size_t i = 0; i < idx->count; i++)
+        fprintf(f, "%" PRIu64 " %" PRIu64 "\n", idx->regions[i].start, idx->regions[i].end);
+
+    const int failed = ferror(f);
+    return fclose(f) != 0 || failed ? -1 : 0;
+}
+
+int index_load(const char *path, struct carrier_index *idx)
+{
+    FILE *f = fopen(path, "r");
+    if (! f)
+        return -1;
+
+    *idx = (struct carrier_index){ 0 };
+    size_t count = 0;
+    int rc = -1;
+    if (fscanf(f, "tynsel-index 2 size %" SCNu64 " mtime %" SCNd64 " data %" SCNu64 " frame %" SCNu32 " lines %" SCNu32
+                " encoding %" SCNu32 " big-endian %" SCNu32 " bits %" SCNu32 " threshold %" SCNu32 " regions %zu",
+                &idx->size, &idx->mtime, &idx->data, &idx->frame, &idx->lines,
+                &idx->encoding, &idx->big_endian, &idx->bits, &idx->threshold, &count) == 10) {
+        rc = 0;
+        for (size_t i = 0; i < count && ! rc; i++) {
+            struct region r;
+            if (fscanf(f, "%" SCNu64 " %" SCNu64, &r.start, &r.end) != 2 || r.end < r.start)
+                rc = -1;
+            else
+                rc = index_add(idx, r.start, r.end);
+        }
+    }
+    fclose(f);
+
+    if (rc) {
+        index_free(idx);
+        errno = EINVAL;
+    }
+    return rc;
+}
+
+void index_free(struct carrier_index *idx)
+{
+    free(idx->regions);
+    idx->regions = NULL;
+    idx->count = idx->capacity = 0;
+}
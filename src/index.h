@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef INDEX_H_
+#define INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Archive recordings are mostly silence, with short bursts of carrier in
+// between. A carrier index lists where the bursts are, so that `listen` can
+// decode just those, taking time in proportion to the traffic instead of to
+// the length of the recording. It is made by a cheap prepass that measures
+// the envelope of every INDEX_BLOCK frames, and saved beside the recording
+// for later runs.
+
+enum {
+    INDEX_BLOCK = 256,  // frames whose envelope is measured together
+    INDEX_PAD   = 2,    // blocks kept on either side of a burst, for the filters to settle
+    INDEX_GAP   = 8,    // blocks of quiet that still do not end a region
+};
+
+struct region {
+    uint64_t start, end;        // in frames, not counting `end`
+};
+
+struct carrier_index {
+    // What the index was made from, so that a stale one is not used
+    uint64_t size;              // of the recording, in bytes
+    int64_t mtime;              // when the recording was last modified
+    uint64_t data;              // where the first frame is stored, in bytes
+    uint32_t frame;             // bytes in a stored frame
+    uint32_t lines;             // samples in a frame
+    uint32_t encoding;          // how a sample is stored (an enum sample_encoding)
+    uint32_t big_endian;        // whether a stored sample is big-endian
+    uint32_t bits;              // in the samples measured
+    uint32_t threshold;         // mean magnitude of a sample, in 16-bit units, that a line must reach
+
+    struct region *regions;
+    size_t count, capacity;
+};
+
+// Adds the magnitudes of `frames` frames of `lines` interleaved samples to
+// each line's sum in `sums`
+void index_envelope8(size_t frames, size_t lines, const int8_t in[], uint32_t sums[]);
+void index_envelope16(size_t frames, size_t lines, const int16_t in[], uint32_t sums[]);
+
+// Adds frames `start` to `end` to the index, merging them with the last
+// region if they are within INDEX_GAP blocks of it. Regions must be added in
+// order. Returns nonzero if memory runs out.
+int index_add(struct carrier_index *idx, uint64_t start, uint64_t end);
+
+// Returns the frames in all the regions
+uint64_t index_frames(const struct carrier_index *idx);
+
+// Writes the index to `path` as text, or reads one back, returning nonzero
+// with errno set on failure. A read index must still be checked against the
+// recording.
+int index_save(const char *path, const struct carrier_index *idx);
+int index_load(const char *path, struct carrier_index *idx);
+
+void index_free(struct carrier_index *idx);
+
+#endif
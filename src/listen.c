@@ -20,15 +20,150 @@
  * IN THE SOFTWARE.
  */
 
+#define _POSIX_C_SOURCE 200809L
+#if defined(__linux__)
+#define _GNU_SOURCE // for pthread_setaffinity_np
+#endif
+
+#include "bus.h"
 #include "coeff.h"
 #include "decode.h"
+#include "format.h"
+#include "index.h"
+#include "profile.h"
+#include "resample.h"
+#include "ring.h"
+#include "save.h"
+#include "vote.h"
 
+#include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Samples are decoded straight out of the input block, so it must be aligned
+// for the widest sample type.
+typedef int16_t DECODE_ALIGNMENT_TYPE;
+enum { BLOCK_SIZE = 8192 };
+
+// The input may interleave several lines (channels, in the audio sense), each
+// carrying its own modem signal and decoded independently.
+enum { MAX_LINES = 32 };
+
+// When pipelined, reading, decoding and writing each get a thread, joined by
+// rings, so that a stall in reading or writing does not hold up decoding.
+enum stage { READER, DECODER, WRITER, STAGE_max };
+enum { INPUT_RING_SIZE = 1 << 20, OUTPUT_RING_SIZE = 1 << 16 };
+
+// A checkpoint holds every line's decoder state, saved by decode_saver, and
+// how much of the input and of each output came before it.
+enum { CHECKPOINT_STATE_MAX = 1024 };
+_Static_assert(CHECKPOINT_STATE_MAX <= UINT16_MAX, "a state's length is saved in 16 bits");
+
+struct line {
+    AUDIO_CONFIG audio;
+    SERIAL_CONFIG serial;
+    const MODEM_PROFILE *profile;
+    const char *output_name; // "-" for stdout; "%d" becomes the line number
+    struct {
+        bool window_size, hysteresis, offset;
+    } given;                 // which of -W, -H and -O were given, even as 0
+    FILE *output;
+    struct filter_config coeffs[CHAN_max * BIT_max];
+    decode_pumper *pump;
+    DECODE_STATE *state;
+    ENSEMBLE_CONFIG ensemble;   // if -E gave members beyond the line itself
+    DECODE_STATE *member[ENSEMBLE_MAX]; // the ensemble's states, the first being `state`
+    struct vote vote;
+    struct resampler resampler; // if decoding at a reduced rate
+    uint64_t decoded;           // samples decoded, at that rate
+    uint64_t written;           // bytes delivered to the output
+};
+
+struct options {
+    uint8_t bits;
+    bool generic;
+    unsigned lines;
+    FILE *input_stream;
+    const char *bus_name;        // if set, the audio bus to read instead
+    struct sample_format format; // how the input is stored
+    bool have_format;            // whether -f gave one
+    FILE *timestamps;            // if set, where to note when bytes are decoded
+    struct line dflt;            // for lines not named by -L
+    struct line line[MAX_LINES];
+    bool named[MAX_LINES];       // whether line[i] was named by -L
+    bool pipelined;
+    long cpu[STAGE_max];         // where each stage runs, or -1 for anywhere
+    long ring_size[2];           // input and output rings, in bytes
+    unsigned long rate;          // if set, the reduced rate to decode at
+    const char *checkpoint;      // if set, where to save checkpoints
+    uint64_t checkpoint_every;   // frames between checkpoints; 0 for only at the end
+    const char *resume;          // if set, the checkpoint to resume from
+    uint64_t start;              // the frame of the recording that the input starts at
+    const char *index_name;      // if set, decode only the regions in this index
+    unsigned threshold;          // envelope at which the index sees a carrier
+    unsigned threads;            // for decoding indexed regions
+};
+
+struct checkpoint {
+    uint64_t frames;            // input frames that went into the states
+    unsigned count;
+    struct {
+        uint64_t written;
+        uint16_t length;
+        unsigned char state[CHECKPOINT_STATE_MAX];
+    } line[MAX_LINES];
+};
+
+// Parses up to `max` comma-separated numbers into `out`, returning how many
+// there were, or -1 if there is anything else.
+static int parse_list(const char *s, long out[], int max)
+{
+    for (int n = 0; n < max; ) {
+        char *end = NULL;
+        out[n++] = strtol(s, &end, 0);
+        if (end == s || (*end != ',' && *end != '\0'))
+            return -1;
+        if (*end == '\0')
+            return n;
+        s = end + 1;
+    }
+
+    return -1;
+}
+
+// Adds a member to the line's ensemble from -E window,threshold,hysteresis,offset,
+// where numbers left out or zero are the line's own.
+static int add_member(struct line *l, const char *s)
+{
+    ENSEMBLE_CONFIG *e = &l->ensemble;
+    long v[4] = { 0 };
+    if (e->members == ENSEMBLE_MAX || parse_list(s, v, 4) < 0) {
+        fprintf(stderr, "Expected up to %d -E window[,threshold[,hysteresis[,offset]]]\n", ENSEMBLE_MAX - 1);
+        return -1;
+    }
+
+    if (! e->members)
+        e->members = 1;
+    e->audio[e->members++] = (AUDIO_CONFIG){
+        .window_size = (uint8_t)v[0],
+        .threshold   = (RMS_OUT_DATA)v[1],
+        .hysteresis  = (int8_t)v[2],
+        .offset      = (int8_t)v[3],
+    };
+
+    return 0;
+}
 
 static FILE *open_file(const char *filename, const char *mode, FILE *dflt)
 {
@@ -38,19 +173,88 @@ static FILE *open_file(const char *filename, const char *mode, FILE *dflt)
     return fopen(filename, mode);
 }
 
-static int parse_opts(AUDIO_CONFIG *c, int argc, char *argv[], uint8_t *bits, FILE **input_stream, FILE **output_stream)
+// Options that come before the first -L apply to every line; after -L N,
+// options describing a line apply to line N alone.
+static int parse_opts(struct options *o, int argc, char *argv[])
 {
+    struct line *l = &o->dflt;
+    unsigned long n;
     int ch;
-    while ((ch = getopt(argc, argv, "C:W:T:H:O:b:F:o:")) != -1) {
+    while ((ch = getopt(argc, argv, "C:W:T:H:O:AS:D:P:M:o:E:b:gf:F:B:N:L:pc:r:t:R:k:K:I:s:x:e:j:")) != -1) {
         switch (ch) {
-            case 'C': c->channel     = strtol(optarg, NULL, 0);         break;
-            case 'W': c->window_size = strtol(optarg, NULL, 0);         break;
-            case 'T': c->threshold   = strtol(optarg, NULL, 0);         break;
-            case 'H': c->hysteresis  = strtol(optarg, NULL, 0);         break;
-            case 'O': c->offset      = strtol(optarg, NULL, 0);         break;
-            case 'b': *bits          = strtol(optarg, NULL, 0);         break;
-            case 'F': *input_stream  = open_file(optarg, "r", stdin );  break;
-            case 'o': *output_stream = open_file(optarg, "w", stdout);  break;
+            case 'C': l->audio.channel      = strtol(optarg, NULL, 0);          break;
+            case 'W': l->audio.window_size  = strtol(optarg, NULL, 0);
+                      l->given.window_size  = true;                             break;
+            case 'T': l->audio.threshold    = strtol(optarg, NULL, 0);          break;
+            case 'H': l->audio.hysteresis   = strtol(optarg, NULL, 0);
+                      l->given.hysteresis   = true;                             break;
+            case 'O': l->audio.offset       = strtol(optarg, NULL, 0);
+                      l->given.offset       = true;                             break;
+            case 'A': l->audio.adaptive     = true;                             break;
+            case 'S': l->audio.squelch      = strtol(optarg, NULL, 0);          break;
+            case 'D': l->serial.data_bits   = strtol(optarg, NULL, 0);          break;
+            case 'P': l->serial.parity_bits = strtol(optarg, NULL, 0);          break;
+            case 'M': l->profile            = find_profile(optarg);             break;
+            case 'o': l->output_name        = optarg;                           break;
+            case 'E':
+                if (add_member(l, optarg))
+                    return -1;
+                break;
+            case 'b': o->bits               = strtol(optarg, NULL, 0);          break;
+            case 'g': o->generic            = true;                             break;
+            case 'F': o->input_stream       = open_file(optarg, "r", stdin);    break;
+            case 'B': o->bus_name           = optarg;                           break;
+            case 'R': o->rate               = strtoul(optarg, NULL, 0);         break;
+            case 'k': o->checkpoint         = optarg;                           break;
+            case 'K': o->checkpoint_every   = strtoull(optarg, NULL, 0);        break;
+            case 'I': o->resume             = optarg;                           break;
+            case 's': o->start              = strtoull(optarg, NULL, 0);        break;
+            case 'x': o->index_name         = optarg;                           break;
+            case 'e': o->threshold          = strtoul(optarg, NULL, 0);         break;
+            case 'j': o->threads            = strtoul(optarg, NULL, 0);         break;
+            case 't':
+                o->timestamps = open_file(optarg, "w", stdout);
+                if (! o->timestamps) {
+                    fprintf(stderr, "Failed to open %s : %s\n", optarg, strerror(errno));
+                    return -1;
+                }
+                break;
+            case 'N': o->lines              = strtoul(optarg, NULL, 0);         break;
+            case 'L':
+                n = strtoul(optarg, NULL, 0);
+                if (n >= MAX_LINES) {
+                    fprintf(stderr, "Line number must be less than %d\n", MAX_LINES);
+                    return -1;
+                }
+                if (! o->named[n])
+                    o->line[n] = o->dflt;
+                o->named[n] = true;
+                l = &o->line[n];
+                break;
+            case 'f':
+                if (format_parse(optarg, &o->format)) {
+                    fprintf(stderr, "Unknown sample format %s\n", optarg);
+                    return -1;
+                }
+                o->have_format = true;
+                break;
+            case 'p':
+                o->pipelined = true;
+                break;
+            case 'c':
+                o->pipelined = true;
+                if (parse_list(optarg, o->cpu, STAGE_max) < 0) {
+                    fprintf(stderr, "Expected -c reader[,decoder[,writer]] CPU numbers\n");
+                    return -1;
+                }
+                break;
+            case 'r':
+                o->pipelined = true;
+                if (parse_list(optarg, o->ring_size, 2) < 0 || o->ring_size[0] <= 0 || o->ring_size[1] <= 0) {
+                    fprintf(stderr, "Expected -r input[,output] ring sizes in bytes\n");
+                    return -1;
+                }
+                break;
 
             default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
         }
@@ -65,74 +269,1073 @@ decode_init decode_state_init16;
 decode_pumper pump_decoder8;
 decode_pumper pump_decoder16;
 
+ensemble_pumper pump_ensemble8;
+ensemble_pumper pump_ensemble16;
+
+decode_selector select_decoder8;
+decode_selector select_decoder16;
+
 decode_fini decode_state_fini8;
 decode_fini decode_state_fini16;
 
-int main(int argc, char *argv[])
+decode_saver decode_state_save8;
+decode_saver decode_state_save16;
+
+decode_loader decode_state_load8;
+decode_loader decode_state_load16;
+
+// Fills in what the options left to the modem profile, and checks the rest.
+// The line is decoded at `rate`, which may be lower than SAMPLE_RATE.
+static int complete_line(struct line *l, unsigned index, unsigned long rate)
+{
+    const MODEM_PROFILE *profile = l->profile;
+    AUDIO_CONFIG *audio = &l->audio;
+
+    if (! profile) {
+        fprintf(stderr, "Unknown modem profile for line %u\n", index);
+        return -1;
+    }
+
+    audio->bit_period = BIT_PERIOD(rate, profile->baud_rate);
+    if (! l->given.window_size) {
+        int window = scale_profile_value_at(profile->window_size, (long)rate);
+        audio->window_size = (uint8_t)(window > MAX_RMS_SAMPLES ? MAX_RMS_SAMPLES : window);
+    }
+    if (! l->given.hysteresis)
+        audio->hysteresis = (int8_t)scale_profile_value_at(profile->hysteresis, (long)rate);
+    if (! l->given.offset)
+        audio->offset = (int8_t)scale_profile_value_at(profile->offset, (long)rate);
+
+    if (audio->window_size < 1) {
+        fprintf(stderr, "Window size must be at least 1\n");
+        return -1;
+    }
+
+#if MAX_RMS_SAMPLES < UINT8_MAX
+    if (audio->window_size > MAX_RMS_SAMPLES) {
+        fprintf(stderr, "Window size must be at most %d\n", MAX_RMS_SAMPLES);
+        return -1;
+    }
+#endif
+
+    // Members of the ensemble take from the line what -E left out
+    ENSEMBLE_CONFIG *e = &l->ensemble;
+    if (e->members)
+        e->audio[0] = *audio;
+    for (uint8_t m = 1; m < e->members; m++) {
+        const AUDIO_CONFIG given = e->audio[m];
+        AUDIO_CONFIG *member = &e->audio[m];
+        *member = *audio;
+        if (given.window_size)
+            member->window_size = given.window_size;
+        if (given.threshold)
+            member->threshold = given.threshold;
+        if (given.hysteresis)
+            member->hysteresis = given.hysteresis;
+        if (given.offset)
+            member->offset = given.offset;
+
+#if MAX_RMS_SAMPLES < UINT8_MAX
+        if (member->window_size > MAX_RMS_SAMPLES) {
+            fprintf(stderr, "Window size must be at most %d\n", MAX_RMS_SAMPLES);
+            return -1;
+        }
+#endif
+    }
+
+    if (audio->channel >= CHAN_max) {
+        fprintf(stderr, "Invalid channel %d for line %u\n", audio->channel, index);
+        return -1;
+    }
+
+    design_notches(l->coeffs, profile, rate);
+#if defined(USE_FILTER_TDF2) && ! defined(USE_FLOATING_POINT)
+    if (notches_peak(l->coeffs) >= FILTER_SUM_LIMIT) {
+        fprintf(stderr, "Line %u's filters could overflow at %lu Hz\n", index, rate);
+        return -1;
+    }
+#endif
+
+    if (rate != SAMPLE_RATE) {
+        const unsigned passband = profile_passband(profile);
+        if (passband >= rate / 2) {
+            fprintf(stderr, "Line %u needs frequencies up to %u Hz, too high to decode at %lu Hz\n", index, passband, rate);
+            return -1;
+        }
+        if (resampler_init(&l->resampler, SAMPLE_RATE, rate)) {
+            perror("Failed to design resampler");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Opens a line's output, replacing the first "%d" in its name with the line
+// number, so that one -o can name a file for every line. When resuming from a
+// checkpoint, a file that already holds more than the `keep` bytes written
+// before it is cut back to them and appended to, so that nothing decoded
+// after the checkpoint is written twice.
+static FILE *open_output(const char *name, unsigned index, bool resuming, uint64_t keep)
+{
+    if (strcmp(name, "-") == 0)
+        return stdout;
+
+    char path[PATH_MAX];
+    const char *hole = strstr(name, "%d");
+    const int wrote = hole
+        ? snprintf(path, sizeof path, "%.*s%u%s", (int)(hole - name), name, index, hole + 2)
+        : snprintf(path, sizeof path, "%s", name);
+    if (wrote < 0 || (size_t)wrote >= sizeof path)
+        return NULL;
+
+    if (! resuming)
+        return fopen(path, "w");
+
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+        if ((uint64_t)st.st_size < keep)
+            fprintf(stderr, "Output for line %u has %lld bytes, fewer than the %" PRIu64 " at the checkpoint\n",
+                    index, (long long)st.st_size, keep);
+        else if (truncate(path, (off_t)keep) != 0)
+            return NULL;
+    }
+
+    return fopen(path, "a");
+}
+
+// Reads a checkpoint written by save_checkpoint(), returning NULL, or else
+// why it could not.
+static const char *read_checkpoint(const char *path, unsigned bits, struct checkpoint *cp)
+{
+    static unsigned char buf[sizeof(struct checkpoint) + 64];
+    FILE *f = fopen(path, "rb");
+    if (! f)
+        return strerror(errno);
+    const size_t size = fread(buf, 1, sizeof buf, f);
+    fclose(f);
+
+    struct load_cursor c = { .at = buf, .end = buf + size };
+    const struct save_header header = { .kind = SAVE_CHECKPOINT, .bits = (uint8_t)bits };
+    const char *why = load_header(&c, &header);
+    if (why)
+        return why;
+
+    uint16_t count;
+    LOAD_FIELD(&c, cp->frames);
+    LOAD_FIELD(&c, count);
+    if (count > MAX_LINES)
+        return "too many lines";
+    cp->count = count;
+
+    for (unsigned i = 0; i < count; i++) {
+        LOAD_FIELD(&c, cp->line[i].written);
+        LOAD_FIELD(&c, cp->line[i].length);
+        if (cp->line[i].length > CHECKPOINT_STATE_MAX)
+            return "a line's state is too large";
+        for (unsigned j = 0; j < cp->line[i].length; j++)
+            LOAD_FIELD(&c, cp->line[i].state[j]);
+    }
+
+    return c.short_read ? "checkpoint is truncated" : NULL;
+}
+
+union block {
+    DECODE_ALIGNMENT_TYPE align;
+    char bytes[BLOCK_SIZE];
+};
+
+// A decoded byte, on its way from the decoder to a line's output
+struct record {
+    uint64_t sample;            // the input frame that completed it
+    uint8_t line;
+    char byte;
+};
+
+struct decoder {
+    struct line *lines;
+    unsigned count;
+    unsigned bits;
+    size_t width;               // bytes in a sample
+    size_t frame;               // bytes in a stored sample for every line
+    const struct sample_format *format; // unless the input is stored as is
+    int input_fd;
+    struct bus *bus;            // if set, read instead of input_fd
+    struct ring *input;         // if pipelined, where input comes from
+    struct ring *output;        // if pipelined, where records go
+    FILE *timestamps;
+    uint64_t frames;            // frames read before the block
+    unsigned long rate;         // the rate lines are decoded at
+    const char *checkpoint;     // if set, where to save checkpoints
+    uint64_t checkpoint_every;  // if set, frames between checkpoints
+    uint64_t next_checkpoint;   // the frame after which to save the next one
+    decode_saver *save;
+    ensemble_pumper *ensemble;
+
+    // A block holds whole frames (one sample for every line); each line's
+    // samples are gathered from it into `lane` and decoded together, so the
+    // input is read once.
+    union block block, lane;
+    union block converted;      // the block's samples, if they needed it
+    int16_t resampled[BLOCK_SIZE / sizeof(int16_t) + 1]; // a line's samples, at a reduced rate
+    size_t capacity;            // a whole number of frames
+    size_t have;
+    struct record records[BLOCK_SIZE];
+};
+
+// Notes which input frame completed a byte, and when the byte went out, so
+// that scripts/latency.sh can find how long each byte took to come through.
+static void stamp(const struct decoder *d, const struct record *r)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(d->timestamps, "%u %d %" PRIu64 " %u %lld.%09ld\n", r->line, d->lines[r->line].audio.channel,
+            r->sample, (unsigned char)r->byte, (long long)now.tv_sec, now.tv_nsec);
+}
+
+// Writes out a decoded byte
+static void deliver(const struct decoder *d, const struct record *r)
+{
+    struct line *l = &d->lines[r->line];
+    fputc(r->byte, l->output);
+    l->written++;
+    if (d->timestamps)
+        stamp(d, r);
+}
+
+// Takes whatever input is available in one read, so that a live stream is
+// not held up waiting for a whole block to fill. Returns zero at the end of
+// the input.
+static size_t read_input(struct decoder *d, char *where, size_t room)
+{
+    if (d->bus)
+        return bus_read(d->bus, where, room);
+
+    while (true) {
+        ssize_t result = read(d->input_fd, where, room);
+
+        if (result <= 0) {
+            if (result == 0)
+                return 0;
+            if (errno == EINTR)
+                continue;
+
+            perror("read failed");
+            exit(EXIT_FAILURE);
+        }
+
+        return (size_t)result;
+    }
+}
+
+static void write_checkpoint(const struct decoder *d, struct save_cursor *c)
+{
+    const struct save_header header = { .kind = SAVE_CHECKPOINT, .bits = (uint8_t)d->bits };
+    save_header(c, &header);
+
+    const uint16_t count = (uint16_t)d->count;
+    SAVE_FIELD(c, d->frames);
+    SAVE_FIELD(c, count);
+    for (unsigned i = 0; i < d->count; i++) {
+        unsigned char state[CHECKPOINT_STATE_MAX];
+        const size_t size = d->save(d->lines[i].state, state, sizeof state);
+        if (size > sizeof state) {
+            fprintf(stderr, "Line %u's state needs %zu bytes, more than a checkpoint holds\n", i, size);
+            exit(EXIT_FAILURE);
+        }
+        const uint16_t length = (uint16_t)size;
+        SAVE_FIELD(c, d->lines[i].written);
+        SAVE_FIELD(c, length);
+        for (unsigned j = 0; j < length; j++)
+            SAVE_FIELD(c, state[j]);
+    }
+}
+
+// Saves every line's state, and how far the input and outputs have got, to
+// the checkpoint file. The file is replaced whole, so that a crash while
+// saving leaves the previous checkpoint in place.
+static void save_checkpoint(const struct decoder *d)
+{
+    static unsigned char buf[sizeof(struct checkpoint) + 64];
+    struct save_cursor c = { .at = buf, .end = buf + sizeof buf };
+    write_checkpoint(d, &c);
+
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof temp, "%s.tmp", d->checkpoint);
+    FILE *f = fopen(temp, "wb");
+    if (! f || fwrite(buf, 1, c.used, f) != c.used || fflush(f) != 0 || fsync(fileno(f)) != 0 ||
+            fclose(f) != 0 || rename(temp, d->checkpoint) != 0) {
+        fprintf(stderr, "Failed to save checkpoint %s : %s\n", d->checkpoint, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Passes over the input up to the frame at which decoding resumes
+static int skip_input(int fd, uint64_t bytes)
+{
+    if (bytes && lseek(fd, (off_t)bytes, SEEK_CUR) >= 0)
+        return 0;
+
+    static char discard[BLOCK_SIZE];
+    while (bytes > 0) {
+        const ssize_t got = read(fd, discard, bytes < sizeof discard ? (size_t)bytes : sizeof discard);
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        bytes -= (uint64_t)got;
+    }
+
+    return 0;
+}
+
+static size_t read_block(struct decoder *d)
+{
+    char *where = d->block.bytes + d->have;
+    const size_t room = d->capacity - d->have;
+    const size_t n = d->input ? ring_read(d->input, where, room) : read_input(d, where, room);
+    d->have += n;
+    return n;
+}
+
+// Passes a decoded byte on to its line's output, or collects it for the
+// writer when pipelined.
+static void emit(struct decoder *d, const struct record *r, size_t *records)
+{
+    if (d->output)
+        d->records[(*records)++] = *r;
+    else
+        deliver(d, r);
+}
+
+// Returns the input frame that corresponds to a line's `f`th sample in the
+// block. Decimating leaves fewer samples to decode; bytes are still reported
+// by the input frame that completed them.
+static uint64_t input_frame(const struct decoder *d, const struct line *l, size_t f)
+{
+    return d->rate != SAMPLE_RATE
+        ? (l->decoded + f) * SAMPLE_RATE / d->rate
+        : d->frames + f;
+}
+
+// Runs a line's samples through its ensemble, passing on the bytes that the
+// members vote for.
+static void decode_ensemble(struct decoder *d, unsigned i, char *samples, size_t count, size_t *records)
+{
+    struct line *l = &d->lines[i];
+    const struct filter_config *coeffs = &l->coeffs[l->audio.channel * BIT_max];
+    for (size_t f = 0; f < count; f++) {
+        char ballot[ENSEMBLE_MAX], decided[ENSEMBLE_MAX + 1];
+        const unsigned cast = d->ensemble(&l->serial, &l->ensemble, coeffs, l->member, &samples[f * d->width], ballot);
+        if (! cast && ! l->vote.cast)
+            continue; // no vote to hold or close
+
+        const size_t n = vote_cast(&l->vote, l->decoded + f, cast, ballot, decided);
+        for (size_t k = 0; k < n; k++) {
+            const struct record r = { .sample = input_frame(d, l, f), .line = (uint8_t)i, .byte = decided[k] };
+            emit(d, &r, records);
+        }
+    }
+}
+
+// Decodes the whole frames in the block, writing what they carry straight to
+// each line's output, or passing it on to the writer when pipelined.
+static void decode_block(struct decoder *d)
+{
+    const size_t width = d->width;
+    const size_t stride = width * d->count;
+    const size_t frames = d->have / d->frame;
+    char *block = d->block.bytes;
+    if (d->format) {
+        format_read(d->format, d->bits, frames * d->count, block, d->converted.bytes);
+        block = d->converted.bytes;
+    }
+
+    size_t records = 0;
+    for (unsigned i = 0; i < d->count; i++) {
+        struct line *l = &d->lines[i];
+        char *samples = block;
+        if (d->count > 1) {
+            for (size_t f = 0; f < frames; f++)
+                memcpy(&d->lane.bytes[f * width], &block[f * stride + i * width], width);
+            samples = d->lane.bytes;
+        }
+
+        size_t decoding = frames;
+        if (d->rate != SAMPLE_RATE) {
+            decoding = resample(&l->resampler, frames, (const int16_t *)samples, d->resampled);
+            samples = (char *)d->resampled;
+        }
+
+        if (l->ensemble.members) {
+            decode_ensemble(d, i, samples, decoding, &records);
+        } else {
+            const struct filter_config *coeffs = &l->coeffs[l->audio.channel * BIT_max];
+            for (size_t f = 0; f < decoding; f++) {
+                char out = 0;
+                if (l->pump(&l->serial, &l->audio, coeffs, l->state, &samples[f * width], &out)) {
+                    const struct record r = { .sample = input_frame(d, l, f), .line = (uint8_t)i, .byte = out };
+                    emit(d, &r, &records);
+                }
+            }
+        }
+        l->decoded += decoding;
+    }
+
+    if (records)
+        ring_write(d->output, d->records, records * sizeof d->records[0]);
+
+    // Keep any partial frame for next time
+    const size_t used = frames * d->frame;
+    memmove(d->block.bytes, d->block.bytes + used, d->have - used);
+    d->have -= used;
+    d->frames += frames;
+
+    if (d->checkpoint_every && d->frames >= d->next_checkpoint) {
+        save_checkpoint(d);
+        d->next_checkpoint = d->frames + d->checkpoint_every;
+    }
+}
+
+// Closes the votes still open at the end of the input
+static void finish_votes(struct decoder *d)
+{
+    size_t records = 0;
+    for (unsigned i = 0; i < d->count; i++) {
+        char decided[1];
+        if (d->lines[i].ensemble.members && vote_flush(&d->lines[i].vote, decided)) {
+            const struct record r = { .sample = d->frames, .line = (uint8_t)i, .byte = decided[0] };
+            emit(d, &r, &records);
+        }
+    }
+
+    if (records)
+        ring_write(d->output, d->records, records * sizeof d->records[0]);
+}
+
+// Reports how often each line's ensemble agreed, and how each member fared
+static void report_votes(const struct decoder *d)
+{
+    for (unsigned i = 0; i < d->count; i++) {
+        const struct line *l = &d->lines[i];
+        const struct vote *v = &l->vote;
+        if (! l->ensemble.members)
+            continue;
+
+        fprintf(stderr, "line %u: %" PRIu64 " votes, %" PRIu64 " unanimous, %" PRIu64 " dropped\n",
+                i, v->votes, v->unanimous, v->dropped);
+        for (unsigned m = 0; m < v->members; m++) {
+            const AUDIO_CONFIG *a = &l->ensemble.audio[m];
+            fprintf(stderr, "line %u member %u (-E %u,%u,%d,%d): %" PRIu64 " missing, %" PRIu64 " dissenting\n",
+                    i, m, a->window_size, (unsigned)a->threshold, a->hysteresis, a->offset, v->missing[m], v->dissent[m]);
+        }
+    }
+}
+
+static void *reader_main(void *arg)
 {
-    FILE *input_stream = stdin;
-    FILE *output_stream = stdout;
+    struct decoder *d = arg;
+    while (! d->bus) {
+        char *where = NULL;
+        const size_t room = ring_reserve(d->input, &where);
+        const size_t n = read_input(d, where, room);
+        if (n == 0)
+            break;
 
-    AUDIO_CONFIG audio = {
-        .channel     = CHAN_ZERO,
-        .window_size = 7,
-        .threshold   = 10,
-        .hysteresis  = 10,
-        .offset      = 12,
+        ring_commit(d->input, n);
+    }
+
+    // The bus gives only whole frames, which may not fit in the room left
+    // before the end of the ring, so they are copied in whole.
+    static union block block;
+    size_t n;
+    while (d->bus && (n = read_input(d, block.bytes, sizeof block.bytes)) > 0)
+        ring_write(d->input, block.bytes, n);
+
+    ring_close(d->input);
+    return NULL;
+}
+
+static void *writer_main(void *arg)
+{
+    struct decoder *d = arg;
+    struct record records[1024];
+    size_t n;
+    while ((n = ring_read(d->output, records, sizeof records)) > 0) {
+        for (size_t i = 0; i < n / sizeof records[0]; i++)
+            deliver(d, &records[i]);
+    }
+
+    return NULL;
+}
+
+static int pin(pthread_t thread, long cpu)
+{
+    if (cpu < 0)
+        return 0;
+
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET((int)cpu, &set);
+    const int rc = pthread_setaffinity_np(thread, sizeof set, &set);
+    if (rc)
+        fprintf(stderr, "Failed to pin to CPU %ld : %s\n", cpu, strerror(rc));
+    return rc;
+#else
+    (void)thread;
+    fprintf(stderr, "Pinning to CPU %ld is not supported on this platform\n", cpu);
+    return -1;
+#endif
+}
+
+// Sets the index to the regions of the input (read from where it is now to
+// the end) where the envelope of any line reaches the threshold: the mean
+// magnitude of its samples, in 16-bit units. Lines are measured apart, so
+// that a carrier on one line of many is not averaged away by the others.
+static int scan_input(struct decoder *d, struct carrier_index *idx)
+{
+    const size_t samples_per_frame = d->count;
+    uint64_t block = 0, frames = 0;
+    uint32_t sum[MAX_LINES] = { 0 };
+    size_t in_block = 0;
+
+    // Notes whether the block just measured has a carrier in it
+    #define NOTE_BLOCK()                                                                    \
+        do {                                                                                \
+            bool active = false;                                                            \
+            for (size_t l = 0; l < samples_per_frame; l++) {                                \
+                const uint64_t scaled = d->bits == 8 ? (uint64_t)sum[l] << 8 : sum[l];      \
+                active |= in_block && scaled >= (uint64_t)idx->threshold * in_block;        \
+                sum[l] = 0;                                                                 \
+            }                                                                               \
+            if (active) {                                                                   \
+                const uint64_t first = block > INDEX_PAD ? block - INDEX_PAD : 0;           \
+                if (index_add(idx, first * INDEX_BLOCK, (block + 1 + INDEX_PAD) * INDEX_BLOCK)) \
+                    return -1;                                                              \
+            }                                                                               \
+            block++;                                                                        \
+            in_block = 0;                                                                   \
+        } while (0)
+
+    while (read_block(d) > 0) {
+        const size_t count = d->have / d->frame;
+        char *samples = d->block.bytes;
+        if (d->format) {
+            format_read(d->format, d->bits, count * samples_per_frame, samples, d->converted.bytes);
+            samples = d->converted.bytes;
+        }
+
+        for (size_t f = 0; f < count; ) {
+            const size_t n = INDEX_BLOCK - in_block < count - f ? INDEX_BLOCK - in_block : count - f;
+            const void *at = &samples[f * d->width * samples_per_frame];
+            if (d->bits == 8)
+                index_envelope8(n, samples_per_frame, at, sum);
+            else
+                index_envelope16(n, samples_per_frame, at, sum);
+            in_block += n;
+            f += n;
+            if (in_block == INDEX_BLOCK)
+                NOTE_BLOCK();
+        }
+
+        const size_t used = count * d->frame;
+        memmove(d->block.bytes, d->block.bytes + used, d->have - used);
+        d->have -= used;
+        frames += count;
+    }
+    NOTE_BLOCK();
+    #undef NOTE_BLOCK
+
+    if (idx->count && idx->regions[idx->count - 1].end > frames)
+        idx->regions[idx->count - 1].end = frames;
+
+    return 0;
+}
+
+// What indexed decoding shares among its threads
+struct indexed {
+    const struct decoder *proto;
+    const struct carrier_index *idx;
+    off_t data;                 // where the first frame is stored
+    decode_init *init;
+    decode_fini *fini;
+    atomic_size_t next;         // the next region to decode
+    struct {
+        char *bytes;
+        size_t length;
+    } (*out)[MAX_LINES];        // for each region and line
+};
+
+static int read_at(int fd, char *buf, size_t size, off_t where)
+{
+    while (size > 0) {
+        const ssize_t got = pread(fd, buf, size, where);
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += got;
+        size -= (size_t)got;
+        where += got;
+    }
+
+    return 0;
+}
+
+// Decodes regions, each from a fresh state, until there are none left. The
+// regions are separated by quiet that would leave the decoder idle anyway.
+static void *indexed_main(void *arg)
+{
+    struct indexed *w = arg;
+    struct decoder *d = malloc(sizeof *d);
+    struct line *lines = malloc(w->proto->count * sizeof *lines);
+    if (! d || ! lines) {
+        perror("Failed to allocate decoder");
+        exit(EXIT_FAILURE);
+    }
+    *d = *w->proto;
+    memcpy(lines, w->proto->lines, w->proto->count * sizeof *lines);
+    d->lines = lines;
+
+    const size_t per_read = d->capacity / d->frame;
+    size_t r;
+    while ((r = atomic_fetch_add(&w->next, 1)) < w->idx->count) {
+        const struct region *region = &w->idx->regions[r];
+        for (unsigned i = 0; i < d->count; i++) {
+            lines[i].state = w->init();
+            lines[i].output = open_memstream(&w->out[r][i].bytes, &w->out[r][i].length);
+            if (! lines[i].state || ! lines[i].output) {
+                perror("Failed to set up region");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        for (uint64_t at = region->start; at < region->end; ) {
+            const size_t n = region->end - at < per_read ? (size_t)(region->end - at) : per_read;
+            if (read_at(d->input_fd, d->block.bytes, n * d->frame, w->data + (off_t)(at * d->frame))) {
+                fprintf(stderr, "Failed to read region at frame %" PRIu64 "\n", at);
+                exit(EXIT_FAILURE);
+            }
+            d->have = n * d->frame;
+            d->frames = at;
+            decode_block(d);
+            at += n;
+        }
+
+        for (unsigned i = 0; i < d->count; i++) {
+            fclose(lines[i].output);
+            w->fini(lines[i].state);
+        }
+    }
+
+    free(lines);
+    free(d);
+    return NULL;
+}
+
+static bool index_matches(const struct carrier_index *a, const struct carrier_index *b)
+{
+    return a->size == b->size && a->mtime == b->mtime && a->data == b->data && a->frame == b->frame &&
+        a->lines == b->lines && a->encoding == b->encoding && a->big_endian == b->big_endian &&
+        a->bits == b->bits && a->threshold == b->threshold;
+}
+
+// Decodes only where the index says there is a carrier, making the index
+// first if there is none for this input, and writes each line's bytes in
+// order once every region is done.
+static int run_indexed(struct decoder *d, const struct options *o, decode_init *init, decode_fini *fini)
+{
+    struct stat st;
+    const off_t data = lseek(d->input_fd, 0, SEEK_CUR);
+    if (fstat(d->input_fd, &st) != 0 || ! S_ISREG(st.st_mode) || data < 0) {
+        fprintf(stderr, "Indexed decoding needs a regular file as input (-F)\n");
+        return -1;
+    }
+
+    // Input stored as the decoder's own samples has no format to convert
+    struct sample_format stored;
+    if (d->format)
+        stored = *d->format;
+    else
+        format_parse(d->bits == 8 ? "s8" : "s16", &stored);
+
+    static struct carrier_index idx;
+    const struct carrier_index want = {
+        .size       = (uint64_t)st.st_size,
+        .mtime      = (int64_t)st.st_mtime,
+        .data       = (uint64_t)data,
+        .frame      = (uint32_t)d->frame,
+        .lines      = (uint32_t)d->count,
+        .encoding   = (uint32_t)stored.encoding,
+        .big_endian = stored.big_endian,
+        .bits       = d->bits,
+        .threshold  = o->threshold,
     };
+    if (index_load(o->index_name, &idx) != 0 || ! index_matches(&idx, &want)) {
+        index_free(&idx);
+        idx = want;
+        if (scan_input(d, &idx)) {
+            perror("Failed to index input");
+            return -1;
+        }
+        if (index_save(o->index_name, &idx))
+            fprintf(stderr, "Failed to save index %s : %s\n", o->index_name, strerror(errno));
+    }
+
+    const uint64_t total = ((uint64_t)st.st_size - (uint64_t)data) / d->frame;
+    fprintf(stderr, "index %s: %zu regions, %" PRIu64 " of %" PRIu64 " frames\n",
+            o->index_name, idx.count, index_frames(&idx), total);
+
+    static struct indexed w;
+    w = (struct indexed){ .proto = d, .idx = &idx, .data = data, .init = init, .fini = fini };
+    w.out = calloc(idx.count ? idx.count : 1, sizeof *w.out);
+    if (! w.out) {
+        perror("Failed to allocate outputs");
+        return -1;
+    }
+    atomic_init(&w.next, 0);
+
+    const unsigned count = o->threads ? o->threads : 1;
+    pthread_t threads[count];
+    for (unsigned t = 1; t < count; t++) {
+        const int rc = pthread_create(&threads[t], NULL, indexed_main, &w);
+        if (rc) {
+            fprintf(stderr, "Failed to start thread : %s\n", strerror(rc));
+            return -1;
+        }
+    }
+    indexed_main(&w);
+    for (unsigned t = 1; t < count; t++)
+        pthread_join(threads[t], NULL);
+
+    for (size_t r = 0; r < idx.count; r++) {
+        for (unsigned i = 0; i < d->count; i++) {
+            fwrite(w.out[r][i].bytes, 1, w.out[r][i].length, d->lines[i].output);
+            d->lines[i].written += w.out[r][i].length;
+            free(w.out[r][i].bytes);
+        }
+    }
+
+    free(w.out);
+    index_free(&idx);
+    return 0;
+}
+
+// Reads and writes on threads of their own, and decodes on this one, then
+// reports how close the rings came to filling.
+static int run_pipeline(struct decoder *d, const struct options *o)
+{
+    static struct ring input, output;
+    if (ring_init(&input, (size_t)o->ring_size[0]) || ring_init(&output, (size_t)o->ring_size[1])) {
+        perror("Failed to allocate rings");
+        return -1;
+    }
+    // A record must never be split across the end of the output ring.
+    _Static_assert((sizeof(struct record) & (sizeof(struct record) - 1)) == 0 && sizeof(struct record) <= 64,
+            "records must divide the ring");
+
+    d->input = &input;
+    d->output = &output;
+
+    pthread_t reader, writer;
+    int rc = pthread_create(&reader, NULL, reader_main, d);
+    if (! rc)
+        rc = pthread_create(&writer, NULL, writer_main, d);
+    if (rc) {
+        fprintf(stderr, "Failed to start threads : %s\n", strerror(rc));
+        return -1;
+    }
+
+    if (pin(reader, o->cpu[READER]) || pin(pthread_self(), o->cpu[DECODER]) || pin(writer, o->cpu[WRITER]))
+        return -1;
+
+    while (read_block(d) > 0)
+        decode_block(d);
+    finish_votes(d);
+    ring_close(&output);
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+
+    fprintf(stderr, "input ring: %zu bytes, high water %zu, full %lu times\n", input.size, input.high, input.full);
+    fprintf(stderr, "output ring: %zu bytes, high water %zu, full %lu times\n", output.size, output.high, output.full);
 
-    uint8_t bits = 16;
-    if (parse_opts(&audio, argc, argv, &bits, &input_stream, &output_stream))
+    ring_fini(&input);
+    ring_fini(&output);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    // Fields that the options leave out are filled in below from the modem
+    // profile.
+    static struct options opts = {
+        .bits    = 16,
+        .dflt    = {
+            .audio = {
+                .channel     = CHAN_ZERO,
+                .threshold   = 10,
+            },
+            .serial = {
+                .data_bits   = 7,
+                .parity_bits = 1,
+                .stop_bits   = 2,
+            },
+            .output_name = "-",
+        },
+        .cpu       = { -1, -1, -1 },
+        .ring_size = { INPUT_RING_SIZE, OUTPUT_RING_SIZE },
+        .threshold = 256,
+    };
+
+    opts.input_stream = stdin;
+    opts.dflt.profile = find_profile("bell103");
+    if (parse_opts(&opts, argc, argv))
+        exit(EXIT_FAILURE);
+
+    if (! opts.threads) {
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        opts.threads = cores > 0 ? (unsigned)cores : 1;
+    }
+
+    if (! opts.input_stream) {
+        perror("Failed to open input");
+        exit(EXIT_FAILURE);
+    }
+
+    // A WAV header says how many lines there are, unless -N does.
+    if (opts.format.wav) {
+        const char *why = NULL;
+        if (opts.bus_name) {
+            fprintf(stderr, "A WAV header cannot be read from a bus; name the sample format instead\n");
+            exit(EXIT_FAILURE);
+        }
+        if (wav_read_header(fileno(opts.input_stream), &opts.format, &why)) {
+            fprintf(stderr, "Failed to read input : %s\n", why);
+            exit(EXIT_FAILURE);
+        }
+        if (opts.format.rate != SAMPLE_RATE) {
+            fprintf(stderr, "Input is sampled at %u Hz, but decoding needs %d Hz\n", opts.format.rate, SAMPLE_RATE);
+            exit(EXIT_FAILURE);
+        }
+        if (opts.lines && opts.lines != opts.format.channels) {
+            fprintf(stderr, "Input has %u channels, but -N gives %u\n", opts.format.channels, opts.lines);
+            exit(EXIT_FAILURE);
+        }
+        opts.lines = opts.format.channels;
+    }
+
+    if (! opts.lines)
+        opts.lines = 1;
+
+    if (! opts.rate)
+        opts.rate = SAMPLE_RATE;
+
+    if (opts.rate > SAMPLE_RATE || (opts.rate != SAMPLE_RATE && opts.bits != 16)) {
+        fprintf(stderr, "Decoding rate must be at most %d Hz, and below it only with bits=16\n", SAMPLE_RATE);
         exit(EXIT_FAILURE);
+    }
+
+    if (opts.lines < 1 || opts.lines > MAX_LINES) {
+        fprintf(stderr, "Number of lines must be between 1 and %d\n", MAX_LINES);
+        exit(EXIT_FAILURE);
+    }
 
     struct {
         decode_init *init;
         decode_pumper *pump;
         decode_fini *fini;
+        decode_selector *select;
+        decode_saver *save;
+        decode_loader *load;
+        ensemble_pumper *ensemble;
     } decoders[] = {
-        [8]  = { decode_state_init8,  pump_decoder8,  decode_state_fini8  },
-        [16] = { decode_state_init16, pump_decoder16, decode_state_fini16 },
+        [8]  = { decode_state_init8,  pump_decoder8,  decode_state_fini8,  select_decoder8,  decode_state_save8,  decode_state_load8,  pump_ensemble8  },
+        [16] = { decode_state_init16, pump_decoder16, decode_state_fini16, select_decoder16, decode_state_save16, decode_state_load16, pump_ensemble16 },
     };
 
+    const uint8_t bits = opts.bits;
     if (bits >= sizeof(decoders) / sizeof(decoders[0]) || ! decoders[bits].init) {
         fprintf(stderr, "No decoder found for bits=%d\n", bits);
         exit(EXIT_FAILURE);
     }
 
-    decode_init   *init_decoder = decoders[bits].init;
-    decode_pumper *pump_decoder = decoders[bits].pump;
-    decode_fini   *fini_decoder = decoders[bits].fini;
+    // Only the first member's state would be saved, or set up for a region.
+    bool ensembles = opts.dflt.ensemble.members;
+    for (unsigned i = 0; i < MAX_LINES; i++)
+        ensembles |= opts.named[i] && opts.line[i].ensemble.members;
+    if (ensembles && (opts.index_name || opts.checkpoint || opts.resume)) {
+        fprintf(stderr, "Ensembles (-E) cannot be combined with -x, -k or -I\n");
+        exit(EXIT_FAILURE);
+    }
 
-    DECODE_STATE *state = init_decoder();
+    if (opts.index_name && (opts.pipelined || opts.bus_name || opts.rate != SAMPLE_RATE || opts.timestamps ||
+                opts.checkpoint || opts.resume)) {
+        fprintf(stderr, "Indexed decoding cannot be combined with -p, -B, -R, -t, -k or -I\n");
+        exit(EXIT_FAILURE);
+    }
 
-    // Do not buffer output at all
-    setvbuf(output_stream, NULL, _IONBF, 0);
+    // Checkpoints are taken between blocks on the decoding thread, and
+    // cover only what that thread holds.
+    if ((opts.checkpoint || opts.resume) && (opts.pipelined || opts.bus_name || opts.rate != SAMPLE_RATE)) {
+        fprintf(stderr, "Checkpoints cannot be combined with -p, -B or -R\n");
+        exit(EXIT_FAILURE);
+    }
 
-    const SERIAL_CONFIG config = {
-        .data_bits   = 7,
-        .parity_bits = 1,
-        .stop_bits   = 2,
+    static struct checkpoint cp;
+    if (opts.resume) {
+        const char *why = read_checkpoint(opts.resume, bits, &cp);
+        if (why) {
+            fprintf(stderr, "Failed to resume from %s : %s\n", opts.resume, why);
+            exit(EXIT_FAILURE);
+        }
+        if (cp.count != opts.lines) {
+            fprintf(stderr, "Checkpoint has %u lines, but the input has %u\n", cp.count, opts.lines);
+            exit(EXIT_FAILURE);
+        }
+        if (cp.frames < opts.start) {
+            fprintf(stderr, "Checkpoint is at frame %" PRIu64 ", before the input starts\n", cp.frames);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const unsigned count = opts.lines;
+    struct line *lines = opts.line;
+    for (unsigned i = count; i < MAX_LINES; i++) {
+        if (opts.named[i]) {
+            fprintf(stderr, "Line %u is not in the input (see -N)\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        struct line *l = &lines[i];
+        if (! opts.named[i])
+            *l = opts.dflt;
+
+        if (complete_line(l, i, opts.rate))
+            exit(EXIT_FAILURE);
+
+        // Several lines could share stdout only by mixing their bytes.
+        if (count > 1 && strcmp(l->output_name, "-") == 0) {
+            fprintf(stderr, "Line %u needs its own output (-o)\n", i);
+            exit(EXIT_FAILURE);
+        }
+
+        l->output = open_output(l->output_name, i, opts.resume, cp.line[i].written);
+        if (! l->output) {
+            fprintf(stderr, "Failed to open output for line %u : %s\n", i, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        // Do not buffer output at all
+        setvbuf(l->output, NULL, _IONBF, 0);
+
+        l->state = decoders[bits].init();
+        l->pump = opts.generic ? decoders[bits].pump : decoders[bits].select(&l->serial, &l->audio);
+
+        // A vote stays open for half a word, well before the next can start.
+        if (l->ensemble.members) {
+            l->member[0] = l->state;
+            for (uint8_t m = 1; m < l->ensemble.members; m++)
+                l->member[m] = decoders[bits].init();
+            const unsigned word = NUM_START_BITS + l->serial.data_bits + l->serial.parity_bits + l->serial.stop_bits;
+            vote_init(&l->vote, l->ensemble.members, (uint64_t)word * l->audio.bit_period / BIT_CLOCK_ONE / 2);
+        }
+
+        if (opts.resume) {
+            const char *why = decoders[bits].load(l->state, cp.line[i].state, cp.line[i].length);
+            if (why) {
+                fprintf(stderr, "Failed to resume line %u : %s\n", i, why);
+                exit(EXIT_FAILURE);
+            }
+            l->written = cp.line[i].written;
+        }
+    }
+
+    static struct decoder d;
+    d = (struct decoder){
+        .lines    = lines,
+        .count    = count,
+        .bits     = bits,
+        .width    = bits / CHAR_BIT,
+        .frame    = bits / CHAR_BIT * count,
+        .input_fd = fileno(opts.input_stream),
+        .timestamps = opts.timestamps,
+        .rate     = opts.rate,
+        .frames   = opts.start,
+        .checkpoint = opts.checkpoint,
+        .checkpoint_every = opts.checkpoint_every,
+        .next_checkpoint = opts.start + opts.checkpoint_every,
+        .save     = decoders[bits].save,
+        .ensemble = decoders[bits].ensemble,
     };
+    if (opts.have_format && ! format_is_native(&opts.format, bits)) {
+        d.format = &opts.format;
+        d.frame = format_width(&opts.format) * count;
+    }
 
-    while (true) {
-        int in = 0;
-        int result = fread(&in, bits / CHAR_BIT, 1, input_stream);
+    // Leave room for the block's frames to be converted, too
+    const size_t largest = d.frame > d.width * count ? d.frame : d.width * count;
+    d.capacity = sizeof d.block.bytes / largest * d.frame;
 
-        if (result != 1) {
-            if (feof(input_stream))
-                break;
+    static struct bus bus;
+    if (opts.bus_name) {
+        if (bus_attach(&bus, opts.bus_name, d.frame)) {
+            fprintf(stderr, "Failed to attach to bus %s : %s\n", opts.bus_name, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        d.bus = &bus;
+        d.frames = bus.tail / d.frame;
+        for (unsigned i = 0; i < count; i++)
+            lines[i].decoded = d.frames * d.rate / SAMPLE_RATE;
+    }
 
-            perror("fread failed");
+    if (opts.resume) {
+        if (skip_input(d.input_fd, (cp.frames - opts.start) * d.frame)) {
+            fprintf(stderr, "Input ends before the checkpoint at frame %" PRIu64 "\n", cp.frames);
             exit(EXIT_FAILURE);
         }
+        d.frames = cp.frames;
+        d.next_checkpoint = cp.frames + opts.checkpoint_every;
+    }
 
-        char out = 0;
-        if (pump_decoder(&config, &audio, &coeff_table[audio.channel], state, &in, &out))
-            fputc(out, output_stream);
+    if (opts.index_name) {
+        if (run_indexed(&d, &opts, decoders[bits].init, decoders[bits].fini))
+            exit(EXIT_FAILURE);
+    } else if (opts.pipelined) {
+        if (run_pipeline(&d, &opts))
+            exit(EXIT_FAILURE);
+    } else {
+        while (read_block(&d) > 0)
+            decode_block(&d);
+        finish_votes(&d);
     }
+    report_votes(&d);
 
-    fini_decoder(state);
+    if (d.checkpoint)
+        save_checkpoint(&d);
+
+    if (d.bus) {
+        if (bus.overruns)
+            fprintf(stderr, "bus %s: overrun %lu times, losing %llu bytes\n", opts.bus_name, bus.overruns, (unsigned long long)bus.lost);
+        bus_detach(&bus);
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        decoders[bits].fini(lines[i].state);
+        for (uint8_t m = 1; m < lines[i].ensemble.members; m++)
+            decoders[bits].fini(lines[i].member[m]);
+        resampler_fini(&lines[i].resampler);
+        if (lines[i].output != stdout)
+            fclose(lines[i].output);
+    }
+
+    if (opts.timestamps && opts.timestamps != stdout)
+        fclose(opts.timestamps);
 
     return 0;
 }
-
@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+// Runs the encoder straight into the decoder, in memory, one thread for each
+// line, to measure the raw throughput of the two together and to soak-test
+// them. Each line sends a seeded pseudo-random stream and checks every byte
+// that comes back against the same stream.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "channel.h"
+#include "coeff.h"
+#include "decode.h"
+#include "encode.h"
+#include "profile.h"
+#include "sine.h"
+#include "state.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// samples synthesized before they are passed on to the decoder
+enum { BLOCK_SAMPLES = 4096 };
+enum { MAX_LINES = 64 };
+
+sines_fill fill_sines16;
+profile_init init_profile16;
+encode_filler encode_bytes_block16, encode_carrier_block16;
+
+decode_init decode_state_init16;
+decode_pumper pump_decoder16;
+decode_selector select_decoder16;
+decode_fini decode_state_fini16;
+decode_saver decode_state_save16;
+decode_loader decode_state_load16;
+
+encode_saver encode_state_save;
+encode_loader encode_state_load;
+
+static const SERIAL_CONFIG serial = {
+    .data_bits   = 8,
+    .parity_bits = 0,
+    .stop_bits   = 2,
+};
+
+struct options {
+    const char *profile;
+    int channel;            // for every line, or -1 to alternate
+    unsigned lines;
+    uint64_t bytes;         // per line, unless `seconds` is set
+    double seconds;         // how long to run for
+    double interval;        // between progress reports, if set
+    uint64_t seed;
+    bool generic;
+    int freq_offset;        // in Hz, added to every tone sent
+    unsigned handoff;       // blocks between moving the states to new ones
+    CHANNEL_CONFIG impair;
+};
+
+// What a line has done so far, read by the main thread for progress reports
+struct line {
+    pthread_t thread;
+    unsigned index;
+    enum channel channel;
+    const struct options *opts;
+    atomic_uint_fast64_t sent, received, errors, samples;
+    uint64_t first_error;   // the index of the first byte that differed
+    bool ok;
+};
+
+static atomic_bool stopping;
+
+// Saves the encoder's and decoder's states and carries on from copies loaded
+// into fresh ones, as a checkpoint and resume would, so that a soak test
+// shows up anything that saving leaves out.
+static void hand_off(BYTE_STATE *s, DECODE_STATE **ds)
+{
+    unsigned char buf[1024];
+    const char *why = NULL;
+
+    BYTE_STATE fresh = { .channel = s->channel };
+    fresh.bit_state.sample_state.quadrant = s->bit_state.sample_state.quadrant;
+    size_t size = encode_state_save(s, buf, sizeof buf);
+    if (size > sizeof buf || (why = encode_state_load(&fresh, buf, size)) != NULL)
+        goto fail;
+    *s = fresh;
+
+    DECODE_STATE *loaded = decode_state_init16();
+    size = decode_state_save16(*ds, buf, sizeof buf);
+    if (size > sizeof buf || (why = decode_state_load16(loaded, buf, size)) != NULL)
+        goto fail;
+    decode_state_fini16(*ds);
+    *ds = loaded;
+    return;
+
+fail:
+    fprintf(stderr, "Failed to hand off state : %s\n", why ? why : "too large");
+    exit(EXIT_FAILURE);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *run_line(void *arg)
+{
+    struct line *l = arg;
+    const struct options *o = l->opts;
+    const MODEM_PROFILE *profile = find_profile(o->profile);
+    const enum channel channel = l->channel;
+
+    MODEM_PROFILE shifted = *profile;
+    for (int c = 0; c < CHAN_max; c++)
+        for (int b = 0; b < BIT_max; b++)
+            shifted.frequencies[c][b] = (uint16_t)(shifted.frequencies[c][b] + o->freq_offset);
+
+    // init_sines16 would fill one table shared by every line
+    int16_t sines[WAVE_TABLE_SIZE];
+    fill_sines16(sines, 0.5);
+    BYTE_STATE s = { .channel = channel };
+    s.bit_state.sample_state.quadrant = sines;
+    init_profile16(&s, &shifted);
+
+    const AUDIO_CONFIG audio = profile_audio(profile, channel, SAMPLE_RATE);
+
+    struct filter_config coeffs[CHAN_max * BIT_max];
+    design_notches(coeffs, profile, SAMPLE_RATE);
+    decode_pumper *pump = o->generic ? pump_decoder16 : select_decoder16(&serial, &audio);
+    DECODE_STATE *ds = decode_state_init16();
+
+    CHANNEL_CONFIG impair = o->impair;
+    impair.seed ^= l->index;
+    CHANNEL_STREAM stream;
+    channel_stream_init(&stream, &impair);
+
+    // Drift is limited to half a sample per sample, so this is enough.
+    int16_t clean[BLOCK_SAMPLES], noisy[BLOCK_SAMPLES * 2 + 2];
+
+    // The sender and the checker run the same sequence, so that nothing
+    // needs to be kept between sending a byte and getting it back.
+    uint64_t sending = o->seed ^ ((uint64_t)l->index << 32);
+    uint64_t checking = sending;
+
+    // a quarter-second of carrier on each end
+    const uint64_t padding = profile->baud_rate / 4 / (NUM_START_BITS + serial.data_bits + serial.parity_bits + serial.stop_bits);
+    uint64_t words = 0, sent = 0, received = 0, errors = 0, samples = 0;
+    uint64_t trailing = 0;
+    unsigned blocks = 0;
+    char byte = (char)channel_random(&sending);
+    l->first_error = UINT64_MAX;
+
+    while (trailing < padding) {
+        size_t done = 0;
+        while (done < BLOCK_SAMPLES && trailing < padding) {
+            const bool finished = o->seconds > 0 ? atomic_load_explicit(&stopping, memory_order_relaxed) : sent >= o->bytes;
+            const bool carrier = words < padding || finished;
+            encode_filler *fill = carrier ? encode_carrier_block16 : encode_bytes_block16;
+            bool accepted = false;
+            done += fill(&serial, &s, true, channel, carrier ? 0 : byte, &accepted, BLOCK_SAMPLES - done, &clean[done]);
+            if (! accepted)
+                continue;
+
+            words++;
+            if (! carrier) {
+                sent++;
+                byte = (char)channel_random(&sending);
+            } else if (words > padding) {
+                trailing++;
+            }
+        }
+
+        const size_t count = channel_stream(&stream, done, clean, noisy);
+        for (size_t i = 0; i < count; i++) {
+            char out = 0;
+            if (pump(&serial, &audio, &coeffs[channel * BIT_max], ds, &noisy[i], &out)) {
+                if (out != (char)channel_random(&checking)) {
+                    if (! errors)
+                        l->first_error = received;
+                    errors++;
+                }
+                received++;
+            }
+        }
+        samples += count;
+
+        if (o->handoff && ++blocks % o->handoff == 0)
+            hand_off(&s, &ds);
+
+        atomic_store_explicit(&l->sent, sent, memory_order_relaxed);
+        atomic_store_explicit(&l->received, received, memory_order_relaxed);
+        atomic_store_explicit(&l->errors, errors, memory_order_relaxed);
+        atomic_store_explicit(&l->samples, samples, memory_order_relaxed);
+    }
+
+    decode_state_fini16(ds);
+    l->ok = errors == 0 && received == sent;
+    return NULL;
+}
+
+static void sleep_until(double when)
+{
+    const double left = when - now();
+    if (left > 0) {
+        const struct timespec ts = { (time_t)left, (long)((left - (time_t)left) * 1e9) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static bool all_sent(const struct line lines[], unsigned count, uint64_t bytes)
+{
+    for (unsigned i = 0; i < count; i++)
+        if (atomic_load_explicit(&lines[i].sent, memory_order_relaxed) < bytes)
+            return false;
+
+    return true;
+}
+
+// Prints the lines' combined progress, as of `seconds` after starting
+static void report(const char *what, const struct line lines[], unsigned count, double seconds)
+{
+    uint64_t sent = 0, received = 0, errors = 0, samples = 0;
+    for (unsigned i = 0; i < count; i++) {
+        sent     += atomic_load_explicit(&lines[i].sent, memory_order_relaxed);
+        received += atomic_load_explicit(&lines[i].received, memory_order_relaxed);
+        errors   += atomic_load_explicit(&lines[i].errors, memory_order_relaxed);
+        samples  += atomic_load_explicit(&lines[i].samples, memory_order_relaxed);
+    }
+
+    printf("%s: %.3f s, %" PRIu64 " bytes sent, %" PRIu64 " received, %" PRIu64 " wrong; "
+            "%.0f bytes/s, %.2f Msamples/s, %.1f real-time lines\n",
+            what, seconds, sent, received, errors,
+            received / seconds, samples / seconds * 1e-6, samples / seconds / SAMPLE_RATE);
+    fflush(stdout);
+}
+
+static int parse_opts(struct options *o, int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "M:C:N:n:d:i:s:gf:G:O:S:K:H:")) != -1) {
+        switch (ch) {
+            case 'M': o->profile          = optarg;                         break;
+            case 'C': o->channel          = strtol  (optarg, NULL, 0);      break;
+            case 'N': o->lines            = strtoul (optarg, NULL, 0);      break;
+            case 'n': o->bytes            = strtoull(optarg, NULL, 0);      break;
+            case 'd': o->seconds          = strtod  (optarg, NULL);         break;
+            case 'i': o->interval         = strtod  (optarg, NULL);         break;
+            case 's': o->seed             = strtoull(optarg, NULL, 0);      break;
+            case 'g': o->generic          = true;                           break;
+            case 'f': o->freq_offset      = strtol  (optarg, NULL, 0);      break;
+            case 'G': o->impair.gain      = strtof  (optarg, NULL);         break;
+            case 'O': o->impair.dc_offset = strtof  (optarg, NULL);         break;
+            case 'S': o->impair.snr       = strtof  (optarg, NULL);         break;
+            case 'K': o->impair.drift     = strtof  (optarg, NULL);         break;
+            case 'H': o->handoff          = strtoul (optarg, NULL, 0);      break;
+
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct options opts = {
+        .profile = "bell103",
+        .channel = -1,
+        .lines   = CHAN_max,
+        .bytes   = 4096,
+        .seed    = 1,
+        .impair  = {
+            .gain = 1.0f,
+            .snr  = INFINITY,
+        },
+    };
+
+    if (parse_opts(&opts, argc, argv))
+        exit(EXIT_FAILURE);
+
+    if (! find_profile(opts.profile)) {
+        fprintf(stderr, "Unknown modem profile\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts.channel < -1 || opts.channel >= CHAN_max) {
+        fprintf(stderr, "Invalid channel %d\n", opts.channel);
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts.lines < 1 || opts.lines > MAX_LINES) {
+        fprintf(stderr, "Number of lines must be between 1 and %d\n", MAX_LINES);
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts.impair.drift <= -0.5f || opts.impair.drift >= 0.5f) {
+        fprintf(stderr, "Drift must be between -0.5 and 0.5\n");
+        exit(EXIT_FAILURE);
+    }
+
+    static struct line lines[MAX_LINES];
+    const double start = now();
+    for (unsigned i = 0; i < opts.lines; i++) {
+        struct line *l = &lines[i];
+        l->index = i;
+        l->channel = (enum channel)(opts.channel < 0 ? (int)(i % CHAN_max) : opts.channel);
+        l->opts = &opts;
+        const int rc = pthread_create(&l->thread, NULL, run_line, l);
+        if (rc) {
+            fprintf(stderr, "Failed to start thread : %s\n", strerror(rc));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Wake for each progress report and for the end of a timed run; a run
+    // of a fixed number of bytes stops on its own.
+    if (opts.interval > 0 || opts.seconds > 0) {
+        for (double next = opts.interval > 0 ? opts.interval : opts.seconds; ; next += opts.interval) {
+            const bool last = opts.seconds > 0 && (opts.interval <= 0 || next >= opts.seconds);
+            sleep_until(start + (last ? opts.seconds : next));
+            if (last) {
+                atomic_store(&stopping, true);
+                break;
+            }
+
+            report("progress", lines, opts.lines, now() - start);
+            if (opts.seconds <= 0 && all_sent(lines, opts.lines, opts.bytes))
+                break;
+        }
+    }
+
+    for (unsigned i = 0; i < opts.lines; i++)
+        pthread_join(lines[i].thread, NULL);
+    const double seconds = now() - start;
+
+    bool ok = true;
+    for (unsigned i = 0; i < opts.lines; i++) {
+        const struct line *l = &lines[i];
+        printf("line %u (%s channel %d): %" PRIu64 " bytes sent, %" PRIu64 " received, %" PRIu64 " wrong",
+                i, opts.profile, l->channel, (uint64_t)atomic_load(&l->sent), (uint64_t)atomic_load(&l->received),
+                (uint64_t)atomic_load(&l->errors));
+        if (l->errors)
+            printf(", first at byte %" PRIu64, l->first_error);
+        printf(": %s\n", l->ok ? "ok" : "FAILED");
+        ok &= l->ok;
+    }
+    report("total", lines, opts.lines, seconds);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
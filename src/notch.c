@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "coeff.h"
+
+#include <math.h>
+
+// Computes the same second-order Pei-Tseng notch as `pei_tseng_notch` in
+// GNU Octave's `signal` package (see scripts/gen_notch.m), so that tone plans
+// other than the one baked into coeff_table can be chosen at runtime.
+static struct filter_config design_notch(double freq, double width, double sample_rate)
+{
+    const double nyquist = sample_rate / 2;
+    const double w0 = M_PI * freq / nyquist;
+    const double bw = M_PI * width / nyquist;
+
+    // The allpass section is fitted at the lower band edge and at the notch
+    // frequency, where its phase must be -pi/2 and -pi respectively.
+    const double omega[2] = { w0 - bw / 2, w0 };
+    const double phi[2] = { -M_PI / 2, -M_PI };
+
+    double q[2][2], t[2];
+    for (int i = 0; i < 2; i++) {
+        t[i] = tan((phi[i] + 2 * omega[i]) / 2);
+        for (int k = 0; k < 2; k++)
+            q[i][k] = sin((k + 1) * omega[i]) - t[i] * cos((k + 1) * omega[i]);
+    }
+
+    const double det = q[0][0] * q[1][1] - q[0][1] * q[1][0];
+    const double a1 = (t[0] * q[1][1] - q[0][1] * t[1]) / det;
+    const double a2 = (q[0][0] * t[1] - q[1][0] * t[0]) / det;
+
+    return (struct filter_config){
+        .coeff_b0 = DEFINE_COEFF((1 + a2) / 2),
+        .coeff_b1 = DEFINE_COEFF(a1),
+        .coeff_a2 = DEFINE_COEFF(a2),
+    };
+}
+
+void design_notches(struct filter_config table[CHAN_max * BIT_max], const MODEM_PROFILE *p, unsigned long sample_rate)
+{
+    for (int c = 0; c < CHAN_max; c++)
+        for (int b = 0; b < BIT_max; b++)
+            table[c * BIT_max + b] = design_notch(p->frequencies[c][b], p->notch_width, sample_rate);
+}
+
+// Sums the magnitudes of the impulse responses from the input to each value
+// that the engine keeps, which bounds that value for any input no larger than
+// the impulse. Each sum the engine forms is then bounded by the magnitudes of
+// the terms that go into it.
+static double notch_peak(const struct filter_config *c)
+{
+    const double b0 = (double)c->coeff_b0 / DEFINE_COEFF(1);
+    const double a1 = (double)c->coeff_a1 / DEFINE_COEFF(1);
+    const double a2 = (double)c->coeff_a2 / DEFINE_COEFF(1);
+
+    double sum[2] = { 0, 0 };
+    double gain_y = 0, gain_xy = 0, gain_sum[2] = { 0, 0 };
+    for (long n = 0; n < 65536; n++) {
+        const double x = n == 0;
+        const double y = b0 * x + sum[0];
+        sum[0] = a1 * (x - y) + sum[1];
+        sum[1] = b0 * x - a2 * y;
+
+        gain_y      += fabs(y);
+        gain_xy     += fabs(x - y);
+        gain_sum[0] += fabs(sum[0]);
+        gain_sum[1] += fabs(sum[1]);
+    }
+
+    const double peak[] = {
+        fabs(b0) + gain_sum[0],             // the output
+        fabs(a1) * gain_xy + gain_sum[1],   // the first sum
+        fabs(b0) + fabs(a2) * gain_y,       // the second sum
+    };
+    return fmax(peak[0], fmax(peak[1], peak[2]));
+}
+
+double notches_peak(const struct filter_config table[CHAN_max * BIT_max])
+{
+    double peak = 0;
+    for (int i = 0; i < CHAN_max * BIT_max; i++)
+        peak = fmax(peak, notch_peak(&table[i]));
+    return peak;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "pool.h"
+
+#include <assert.h>
+
+void *pool_get(struct pool *p)
+{
+    uint64_t head = atomic_load_explicit(&p->head, memory_order_acquire);
+    while ((uint32_t)head != POOL_NONE) {
+        const uint32_t index = (uint32_t)head;
+        const uint32_t next = atomic_load_explicit(&p->next[index], memory_order_relaxed);
+        const uint64_t popped = (((head >> 32) + 1) << 32) | next;
+        if (atomic_compare_exchange_weak_explicit(&p->head, &head, popped, memory_order_acquire, memory_order_acquire))
+            return p->arena + index * p->stride;
+    }
+
+    uint32_t fresh = atomic_load_explicit(&p->fresh, memory_order_relaxed);
+    while (fresh < p->capacity) {
+        if (atomic_compare_exchange_weak_explicit(&p->fresh, &fresh, fresh + 1, memory_order_relaxed, memory_order_relaxed))
+            return p->arena + fresh * p->stride;
+    }
+
+    return NULL;
+}
+
+void pool_put(struct pool *p, void *object)
+{
+    const size_t offset = (size_t)((char*)object - p->arena);
+    assert(offset % p->stride == 0 && offset / p->stride < p->capacity);
+    const uint32_t index = (uint32_t)(offset / p->stride);
+
+    uint64_t head = atomic_load_explicit(&p->head, memory_order_relaxed);
+    uint64_t pushed;
+    do {
+        atomic_store_explicit(&p->next[index], (uint32_t)head, memory_order_relaxed);
+        pushed = (((head >> 32) + 1) << 32) | index;
+    } while (! atomic_compare_exchange_weak_explicit(&p->head, &head, pushed, memory_order_release, memory_order_relaxed));
+}
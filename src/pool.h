@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Objects in a pool each start on a cache line of their own, so that objects
+// used by different threads never share one.
+#define POOL_ALIGN 64
+
+#define POOL_NONE UINT32_MAX
+
+// A fixed number of equally-sized objects in an arena, handed out and taken
+// back without locks, so that threads opening and closing sessions do not
+// contend on an allocator. Objects that were never handed out come from a
+// bump index, and returned ones from a free list (a stack, whose head carries
+// a tag so that it cannot be mistaken for an earlier head of the same index).
+struct pool {
+    char *arena;
+    size_t stride;              // bytes per object
+    uint32_t capacity;
+    _Atomic uint32_t fresh;     // the first object never handed out
+    _Atomic uint64_t head;      // tag << 32 | index of the first free object
+    _Atomic uint32_t *next;     // for each free object, the index of the next
+};
+
+// Makes a pool of the elements of the array `Arena`, with `Next` an array of
+// as many _Atomic uint32_t.
+#define POOL_INITIALIZER(Arena, Next) { \
+        .arena    = (char*)(Arena), \
+        .stride   = sizeof (Arena)[0], \
+        .capacity = sizeof (Arena) / sizeof (Arena)[0], \
+        .head     = POOL_NONE, \
+        .next     = (Next), \
+    } \
+    // end macro
+
+// Returns an object from the pool, with whatever it last held, or NULL if
+// every object is in use.
+void *pool_get(struct pool *p);
+
+// Returns `object`, which came from pool_get(), to the pool.
+void pool_put(struct pool *p, void *object);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "profile.h"
+
+#include <stddef.h>
+#include <string.h>
+
+static const struct {
+    const char *name;
+    MODEM_PROFILE profile;
+} profiles[] = {
+    {
+        .name = "bell103",
+        .profile = {
+            .baud_rate   = 300,
+            .notch_width = 150,
+            .frequencies = { FREQUENCY_LIST(INIT_2D_ARRAY) },
+            .window_size = 7,
+            .hysteresis  = 10,
+            .offset      = 12,
+        },
+    },
+    {
+        // Bell 202 is half-duplex, so both channels use the same tones
+        .name = "bell202",
+        .profile = {
+            .baud_rate   = 1200,
+            .notch_width = 600,
+            .frequencies = {
+                [CHAN_ZERO] = { [BIT_ZERO] = 2200, [BIT_ONE] = 1200 },
+                [CHAN_ONE ] = { [BIT_ZERO] = 2200, [BIT_ONE] = 1200 },
+            },
+            .window_size = 4,
+            .hysteresis  = 2,
+            .offset      = 3,
+        },
+    },
+    {
+        .name = "v21",
+        .profile = {
+            .baud_rate   = 300,
+            .notch_width = 150,
+            .frequencies = {
+                [CHAN_ZERO] = { [BIT_ZERO] = 1180, [BIT_ONE] =  980 },
+                [CHAN_ONE ] = { [BIT_ZERO] = 1850, [BIT_ONE] = 1650 },
+            },
+            .window_size = 7,
+            .hysteresis  = 10,
+            .offset      = 12,
+        },
+    },
+};
+
+const MODEM_PROFILE *find_profile(const char *name)
+{
+    for (size_t i = 0; i < sizeof profiles / sizeof profiles[0]; i++)
+        if (strcmp(profiles[i].name, name) == 0)
+            return &profiles[i].profile;
+
+    return NULL;
+}
+
+int scale_profile_value_at(int value, long rate)
+{
+    const long tuned = 8000;
+    return (int)((value * rate + tuned / 2) / tuned);
+}
+
+int scale_profile_value(int value)
+{
+    return scale_profile_value_at(value, SAMPLE_RATE);
+}
+
+unsigned profile_passband(const MODEM_PROFILE *p)
+{
+    unsigned highest = 0;
+    for (int c = 0; c < CHAN_max; c++)
+        for (int b = 0; b < BIT_max; b++)
+            if (p->frequencies[c][b] > highest)
+                highest = p->frequencies[c][b];
+
+    return highest + p->notch_width / 2;
+}
+
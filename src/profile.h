@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "decode.h"
+#include "types.h"
+
+// Returns the named modem profile ("bell103", "bell202" or "v21"), or NULL.
+const MODEM_PROFILE *find_profile(const char *name);
+
+// Profile decoder defaults (window size, hysteresis and offset) are tuned at
+// 8000Hz; this scales one of them to SAMPLE_RATE, or to another rate.
+int scale_profile_value(int value);
+int scale_profile_value_at(int value, long rate);
+
+// Returns the decoder settings that a profile suggests for decoding `channel`
+// at `rate`, clamping its window to what the decoder can hold. This lives here
+// rather than in profile.c because AUDIO_CONFIG and MAX_RMS_SAMPLES change
+// with the decoder that the caller is built against (fixed point or float,
+// windowed or moving-average power), and profile.o is built only once.
+static inline AUDIO_CONFIG profile_audio(const MODEM_PROFILE *p, enum channel channel, long rate)
+{
+    const int window = scale_profile_value_at(p->window_size, rate);
+    return (AUDIO_CONFIG){
+        .channel     = channel,
+        .window_size = (uint8_t)(window > MAX_RMS_SAMPLES ? MAX_RMS_SAMPLES : window),
+        .threshold   = 10,
+        .hysteresis  = (int8_t)scale_profile_value_at(p->hysteresis, rate),
+        .offset      = (int8_t)scale_profile_value_at(p->offset, rate),
+        .bit_period  = BIT_PERIOD(rate, p->baud_rate),
+    };
+}
+
+// Returns the highest frequency, in Hz, that a profile's notches must pass.
+unsigned profile_passband(const MODEM_PROFILE *p);
+
+#endif
+
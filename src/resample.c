@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "resample.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static unsigned long gcd(unsigned long a, unsigned long b)
+{
+    while (b) {
+        const unsigned long t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+int resampler_init(struct resampler *r, unsigned long from, unsigned long to)
+{
+    const unsigned long g = gcd(from, to);
+    *r = (struct resampler){
+        .up = (unsigned)(to / g),
+        .down = (unsigned)(from / g),
+    };
+    r->phase = r->up;
+
+    const unsigned up = r->up;
+    const size_t length = (size_t)up * RESAMPLE_TAPS;
+    r->taps = malloc(length * sizeof *r->taps);
+    if (! r->taps)
+        return -1;
+
+    // A Blackman-windowed sinc, at `up` times the input rate, cut off at the
+    // lower of the two Nyquist frequencies. The transition band straddles the
+    // cutoff, so what aliases folds back to just below it, well clear of the
+    // modem tones, which pass nearly flat. Each phase is normalized on its
+    // own, so that every output passes DC at unity gain however the taps fall.
+    const double nyquist = (from < to ? from : to) / 2.0;
+    const double cutoff = nyquist / ((double)from * up);
+    const double centre = (length - 1) / 2.0;
+    double *prototype = malloc(length * sizeof *prototype);
+    if (! prototype) {
+        free(r->taps);
+        return -1;
+    }
+    for (size_t n = 0; n < length; n++) {
+        const double x = n - centre;
+        const double sinc = x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+        const double window = 0.42 - 0.5 * cos(2 * M_PI * n / (length - 1)) + 0.08 * cos(4 * M_PI * n / (length - 1));
+        prototype[n] = sinc * window;
+    }
+
+    for (unsigned p = 0; p < up; p++) {
+        double sum = 0;
+        for (unsigned k = 0; k < RESAMPLE_TAPS; k++)
+            sum += prototype[p + (size_t)k * up];
+        // Tap k meets the input k samples before the newest, so the phase's
+        // taps are stored oldest first, to match the history.
+        for (unsigned k = 0; k < RESAMPLE_TAPS; k++)
+            r->taps[p * RESAMPLE_TAPS + (RESAMPLE_TAPS - 1 - k)] = (int16_t)lrint(prototype[p + (size_t)k * up] / sum * 32767);
+    }
+
+    free(prototype);
+    return 0;
+}
+
+void resampler_fini(struct resampler *r)
+{
+    free(r->taps);
+    r->taps = NULL;
+}
+
+size_t resample_length(const struct resampler *r, size_t count)
+{
+    return ((size_t)count * r->up + r->down - 1) / r->down + 1;
+}
+
+size_t resample(struct resampler *r, size_t count, const int16_t in[], int16_t out[])
+{
+    size_t made = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (++r->newest == RESAMPLE_TAPS)
+            r->newest = 0;
+        r->history[r->newest] = r->history[r->newest + RESAMPLE_TAPS] = in[i];
+        r->phase -= r->up;
+
+        // every output that falls between this input and the next
+        const int16_t *window = &r->history[r->newest + 1];
+        while (r->phase < r->up) {
+            const int16_t *taps = &r->taps[r->phase * RESAMPLE_TAPS];
+            int32_t sum = 0;
+            for (int k = 0; k < RESAMPLE_TAPS; k++)
+                sum += (int32_t)taps[k] * window[k];
+
+            sum = (sum + (1 << 14)) >> 15;
+            out[made++] = (int16_t)(sum > INT16_MAX ? INT16_MAX : sum < INT16_MIN ? INT16_MIN : sum);
+            r->phase += r->down;
+        }
+    }
+
+    return made;
+}
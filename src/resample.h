@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef RESAMPLE_H_
+#define RESAMPLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Taps of the anti-aliasing filter that contribute to each output sample
+enum { RESAMPLE_TAPS = 24 };
+
+// Converts a stream of 16-bit samples from one rate to another, as a
+// polyphase FIR filter: conceptually, the input is stuffed with zeros up to
+// the least common multiple of the two rates, low-pass filtered below the
+// lower Nyquist frequency, and decimated, but only the taps that meet
+// nonzero inputs at the wanted outputs are ever computed.
+struct resampler {
+    unsigned up, down;          // output rate over input rate, in lowest terms
+    unsigned phase;             // the next output's distance from the newest input, in units of 1/up input
+    unsigned newest;            // where the newest input is in `history`
+    int16_t *taps;              // `up` phases of RESAMPLE_TAPS each, oldest input first
+    int16_t history[2 * RESAMPLE_TAPS]; // the inputs twice over, so that any window is contiguous
+};
+
+// Prepares `r` to convert from `from` Hz to `to` Hz. Returns nonzero if
+// memory could not be allocated.
+int resampler_init(struct resampler *r, unsigned long from, unsigned long to);
+void resampler_fini(struct resampler *r);
+
+// Returns the most outputs that resample() can make from `count` inputs
+size_t resample_length(const struct resampler *r, size_t count);
+
+// Converts `count` input samples, writing the output samples that they
+// complete to `out`; returns how many were written.
+size_t resample(struct resampler *r, size_t count, const int16_t in[], int16_t out[]);
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "ring.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// How a side waits for the other: spinning first, because the other side is
+// likely to be running on another core, and sleeping only once a wait has
+// gone on long enough that a little more latency does not matter.
+enum { SPINS = 64, YIELDS = 64 };
+static const struct timespec nap = { .tv_nsec = 50000 };
+
+static void backoff(unsigned *tries)
+{
+    if (*tries < SPINS) {
+        // just try again
+    } else if (*tries < SPINS + YIELDS) {
+        sched_yield();
+    } else {
+        nanosleep(&nap, NULL);
+    }
+    ++*tries;
+}
+
+int ring_init(struct ring *r, size_t size)
+{
+    size_t rounded = 64;
+    while (rounded < size)
+        rounded *= 2;
+
+    *r = (struct ring){ .size = rounded };
+    r->buf = malloc(rounded);
+    return r->buf == NULL;
+}
+
+void ring_fini(struct ring *r)
+{
+    free(r->buf);
+    r->buf = NULL;
+}
+
+size_t ring_reserve(struct ring *r, char **where)
+{
+    const size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned tries = 0;
+    while (head - r->seen_tail == r->size) {
+        if (tries == 0)
+            r->full++;
+        backoff(&tries);
+        r->seen_tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    }
+
+    const size_t offset = head & (r->size - 1);
+    const size_t room = r->size - (head - r->seen_tail);
+    const size_t contiguous = r->size - offset;
+    *where = r->buf + offset;
+    return room < contiguous ? room : contiguous;
+}
+
+void ring_commit(struct ring *r, size_t count)
+{
+    const size_t head = atomic_load_explicit(&r->head, memory_order_relaxed) + count;
+    atomic_store_explicit(&r->head, head, memory_order_release);
+
+    r->seen_tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - r->seen_tail > r->high)
+        r->high = head - r->seen_tail;
+}
+
+void ring_write(struct ring *r, const void *data, size_t count)
+{
+    const char *from = data;
+    while (count > 0) {
+        char *where = NULL;
+        size_t n = ring_reserve(r, &where);
+        if (n > count)
+            n = count;
+        memcpy(where, from, n);
+        ring_commit(r, n);
+        from += n;
+        count -= n;
+    }
+}
+
+void ring_close(struct ring *r)
+{
+    atomic_store_explicit(&r->closed, true, memory_order_release);
+}
+
+size_t ring_read(struct ring *r, void *data, size_t max)
+{
+    const size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    unsigned tries = 0;
+    while (r->seen_head == tail) {
+        // Check for closing before looking at the head, so that data written
+        // before the ring closed is not missed.
+        const bool closed = atomic_load_explicit(&r->closed, memory_order_acquire);
+        r->seen_head = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (r->seen_head != tail)
+            break;
+        if (closed)
+            return 0;
+        if (tries == 0)
+            r->empty++;
+        backoff(&tries);
+    }
+
+    size_t n = r->seen_head - tail;
+    if (n > max)
+        n = max;
+
+    // The data may wrap around the end of the buffer
+    const size_t offset = tail & (r->size - 1);
+    const size_t first = r->size - offset < n ? r->size - offset : n;
+    memcpy(data, r->buf + offset, first);
+    memcpy((char*)data + first, r->buf, n - first);
+
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+    return n;
+}
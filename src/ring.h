@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef RING_H_
+#define RING_H_
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// A ring of bytes passed from one producer thread to one consumer thread
+// without locks. Each side owns one index and only reads the other's, and the
+// two indices live on separate cache lines. A side that finds the ring full
+// (or empty) spins briefly, then yields, then sleeps, so that neither needs
+// to be woken.
+struct ring {
+    // written by the producer
+    alignas(64) _Atomic size_t head;    // bytes ever written
+    size_t seen_tail;                   // the tail when last read
+    size_t high;                        // the most bytes ever waiting
+    unsigned long full;                 // times the ring was found full
+
+    // written by the consumer
+    alignas(64) _Atomic size_t tail;    // bytes ever read
+    size_t seen_head;                   // the head when last read
+    unsigned long empty;                // times the ring was found empty
+
+    alignas(64) char *buf;
+    size_t size;                        // a power of two
+    atomic_bool closed;                 // the producer is done
+};
+
+// Makes `r` hold at least `size` bytes (rounded up to a power of two).
+// Returns nonzero if memory could not be allocated.
+int ring_init(struct ring *r, size_t size);
+void ring_fini(struct ring *r);
+
+// Waits for room, then returns in `where` the start of as many free bytes
+// as are contiguous, and their count, for the producer to fill and commit.
+size_t ring_reserve(struct ring *r, char **where);
+void ring_commit(struct ring *r, size_t count);
+
+// Writes all of `count` bytes, waiting for room as needed.
+void ring_write(struct ring *r, const void *data, size_t count);
+
+// Marks the end of the producer's data.
+void ring_close(struct ring *r);
+
+// Waits for data, then reads up to `max` bytes into `data`. Returns zero
+// only once the ring is closed and empty.
+size_t ring_read(struct ring *r, void *data, size_t max);
+
+#endif
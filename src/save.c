@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "save.h"
+
+#include <string.h>
+
+static const unsigned char magic[4] = { 't', 'y', 'n', 'S' };
+
+void save_put(struct save_cursor *c, const void *field, size_t size)
+{
+    // Fields are integers or floats of 1, 2, 4 or 8 bytes, so widening to
+    // 64 bits and taking the low bytes in turn gives little-endian order.
+    uint64_t value = 0;
+    switch (size) {
+        case 1: { uint8_t  v; memcpy(&v, field, size); value = v; break; }
+        case 2: { uint16_t v; memcpy(&v, field, size); value = v; break; }
+        case 4: { uint32_t v; memcpy(&v, field, size); value = v; break; }
+        case 8: { uint64_t v; memcpy(&v, field, size); value = v; break; }
+    }
+
+    for (size_t i = 0; i < size; i++, value >>= 8) {
+        if (c->at && c->at < c->end)
+            *c->at++ = (unsigned char)value;
+        c->used++;
+    }
+}
+
+void save_get(struct load_cursor *c, void *field, size_t size)
+{
+    if ((size_t)(c->end - c->at) < size) {
+        c->short_read = true;
+        memset(field, 0, size);
+        return;
+    }
+
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++)
+        value |= (uint64_t)c->at[i] << (8 * i);
+    c->at += size;
+
+    switch (size) {
+        case 1: { uint8_t  v = (uint8_t )value; memcpy(field, &v, size); break; }
+        case 2: { uint16_t v = (uint16_t)value; memcpy(field, &v, size); break; }
+        case 4: { uint32_t v = (uint32_t)value; memcpy(field, &v, size); break; }
+        case 8: { uint64_t v = (uint64_t)value; memcpy(field, &v, size); break; }
+    }
+}
+
+bool load_bool_valid(const bool *field)
+{
+    unsigned char byte;
+    memcpy(&byte, field, sizeof byte);
+    return byte <= 1;
+}
+
+void save_header(struct save_cursor *c, const struct save_header *h)
+{
+    for (size_t i = 0; i < sizeof magic; i++)
+        SAVE_FIELD(c, magic[i]);
+
+    const uint16_t version = SAVE_VERSION;
+    SAVE_FIELD(c, version);
+    SAVE_FIELD(c, h->kind);
+    SAVE_FIELD(c, h->bits);
+    SAVE_FIELD(c, h->flags);
+    SAVE_FIELD(c, h->window);
+}
+
+const char *load_header(struct load_cursor *c, const struct save_header *h)
+{
+    unsigned char m[sizeof magic];
+    for (size_t i = 0; i < sizeof m; i++)
+        LOAD_FIELD(c, m[i]);
+
+    uint16_t version;
+    struct save_header got;
+    LOAD_FIELD(c, version);
+    LOAD_FIELD(c, got.kind);
+    LOAD_FIELD(c, got.bits);
+    LOAD_FIELD(c, got.flags);
+    LOAD_FIELD(c, got.window);
+
+    if (c->short_read || memcmp(m, magic, sizeof m) != 0)
+        return "not a saved state";
+    if (version != SAVE_VERSION)
+        return "saved by another version";
+    if (got.kind != h->kind)
+        return "a different kind of saved state";
+    if (got.bits != h->bits || got.flags != h->flags || got.window != h->window)
+        return "saved by a differently built decoder";
+
+    return NULL;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef SAVE_H_
+#define SAVE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Decoder and encoder states are saved field by field, each field
+// little-endian at its own size, behind a header that names the layout and
+// its version. A state can then move between machines of either byte order,
+// and a state from a different build (of another sample width, say) is
+// refused instead of misread.
+
+// Bump when a saved field is added, removed or resized.
+enum { SAVE_VERSION = 1 };
+
+// How a layout varies with the build
+enum save_kind { SAVE_DECODER = 1, SAVE_ENCODER = 2, SAVE_CHECKPOINT = 3 }; // checkpoints are listen's
+enum save_flags { SAVE_FLOAT = 1, SAVE_EMA = 2, SAVE_TDF2 = 4 };
+
+struct save_header {
+    uint8_t kind;       // see enum save_kind
+    uint8_t bits;       // the sample width, for decoders
+    uint8_t flags;      // see enum save_flags
+    uint8_t window;     // MAX_RMS_SAMPLES, for decoders
+};
+
+// Writes to `at`, stopping at `end` but counting everything, so that a
+// caller can learn how much room a state needs.
+struct save_cursor {
+    unsigned char *at;
+    const unsigned char *end;
+    size_t used;
+};
+
+// Reads from `at` up to `end`, noting whether it ran out.
+struct load_cursor {
+    const unsigned char *at;
+    const unsigned char *end;
+    bool short_read;
+};
+
+void save_put(struct save_cursor *c, const void *field, size_t size);
+void save_get(struct load_cursor *c, void *field, size_t size);
+
+#define SAVE_FIELD(C,F) save_put((C), &(F), sizeof(F))
+#define LOAD_FIELD(C,F) save_get((C), &(F), sizeof(F))
+
+// Returns whether a bool filled in by save_get() holds 0 or 1. A corrupt
+// state can put anything there, and reading that as a bool is undefined, so
+// the byte is looked at instead.
+bool load_bool_valid(const bool *field);
+
+void save_header(struct save_cursor *c, const struct save_header *h);
+
+// Returns NULL if the header matches `h`, or else why it does not.
+const char *load_header(struct load_cursor *c, const struct save_header *h);
+
+#endif
@@ -46,10 +46,15 @@ void CAT(make_sine_table,ENCODE_BITS)(size_t size, SINE_TABLE_TYPE sines[size],
     }
 }
 
+void CAT(fill_sines,ENCODE_BITS)(void *sines, float gain)
+{
+    CAT(make_sine_table,ENCODE_BITS)(WAVE_TABLE_SIZE, (SINE_TABLE_TYPE*)sines, gain);
+}
+
 void CAT(init_sines,ENCODE_BITS)(const void **sines, float gain)
 {
     static SINE_TABLE_TYPE private_sines[WAVE_TABLE_SIZE];
-    CAT(make_sine_table,ENCODE_BITS)(WAVE_TABLE_SIZE, private_sines, gain);
+    CAT(fill_sines,ENCODE_BITS)(private_sines, gain);
     *sines = &private_sines;
 }
 
@@ -30,6 +30,9 @@
 #define WAVE_TABLE_SIZE 64u
 
 typedef void sines_init(const void **table, float gain);
+// Like sines_init, but into a table of WAVE_TABLE_SIZE entries owned by the
+// caller, so that encoders with different gains can run side by side.
+typedef void sines_fill(void *table, float gain);
 
 #endif
 
@@ -38,9 +38,11 @@ struct sample_state {
 
 struct bit_state {
     SAMPLE_STATE sample_state;
+    PHASE_STEP steps[CHAN_max][BIT_max];
     PHASE_STEP step;
+    uint16_t bit_period; // see BIT_PERIOD()
+    uint16_t clock; // time left in the current bit, in the same units
     enum channel channel;
-    uint8_t samples_remaining;
 };
 
 struct byte_state {
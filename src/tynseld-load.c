@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+// Opens many sessions with `tynseld` at once and drives them as fast as the
+// daemon will go, checking every reply, to measure how many sessions' worth
+// of real-time audio the daemon keeps up with.
+
+#define _GNU_SOURCE
+
+#include "encode.h"
+#include "profile.h"
+#include "sine.h"
+#include "state.h"
+#include "tynseld.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// samples synthesized per call to an encode_filler
+enum { BLOCK_SAMPLES = 4096 };
+enum { READ_CHUNK = 65536 };
+enum { MAX_EVENTS = 256 };
+
+sines_init init_sines16;
+profile_init init_profile16;
+encode_filler encode_bytes_block16, encode_carrier_block16;
+
+static const SERIAL_CONFIG serial = {
+    .data_bits   = 8,
+    .parity_bits = 0,
+    .stop_bits   = 2,
+};
+
+struct options {
+    const char *path;
+    unsigned sessions;
+    size_t length;
+    const char *profile;
+    int channel;
+    bool encode;
+    bool metrics;
+};
+
+// What every session sends, and what it should get back
+struct script {
+    char header[TYNSELD_HEADER_MAX];
+    size_t header_len;
+    const char *send;
+    size_t send_len;
+    const char *expect;
+    size_t expect_len;
+};
+
+struct session {
+    int fd;
+    size_t sent;        // counting the header
+    size_t received;
+    bool failed;
+};
+
+static void *allocate(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+    if (! p) {
+        fprintf(stderr, "Failed to allocate %zu bytes\n", size);
+        exit(EXIT_FAILURE);
+    }
+
+    return p;
+}
+
+// Encodes `len` bytes the way `gen` (and so `tynseld`) does, returning the
+// number of samples, in a buffer that the caller frees
+static int16_t *synthesize(const MODEM_PROFILE *p, enum channel channel, size_t len, const char data[len], size_t *count)
+{
+    const size_t bit_count = NUM_START_BITS + serial.data_bits + serial.parity_bits + serial.stop_bits;
+    const size_t padding = p->baud_rate / bit_count;
+    const size_t words = 2 * padding + len;
+    int16_t *out = allocate((((words + 2) * bit_count + 1) * BIT_PERIOD(SAMPLE_RATE, p->baud_rate) / BIT_CLOCK_ONE + BLOCK_SAMPLES) * sizeof *out);
+
+    BYTE_STATE s = { .channel = channel };
+    init_sines16(&s.bit_state.sample_state.quadrant, 0.5);
+    init_profile16(&s, p);
+
+    size_t done = 0;
+    for (size_t i = 0; i < words; /* incremented inside loop */) {
+        const bool carrier = i < padding || i >= padding + len;
+        encode_filler *fill = carrier ? encode_carrier_block16 : encode_bytes_block16;
+        bool accepted = false;
+        done += fill(&serial, &s, true, channel, carrier ? 0 : data[i - padding], &accepted, BLOCK_SAMPLES, &out[done]);
+        if (accepted)
+            i++;
+    }
+
+    // drain the encoder, leaving off the sample that accepted the last word
+    for (bool accepted = false; ! accepted; /* set inside loop */) {
+        done += encode_carrier_block16(&serial, &s, true, channel, 0, &accepted, BLOCK_SAMPLES, &out[done]);
+        done -= accepted;
+    }
+
+    *count = done;
+    return out;
+}
+
+static int connect_to(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "Socket path too long : %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof addr) != 0) {
+        fprintf(stderr, "Failed to connect to %s : %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Sends what is left for the session, as far as the socket will take it;
+// returns false once everything is sent.
+static bool send_some(struct session *s, const struct script *p)
+{
+    while (true) {
+        const char *from;
+        size_t left;
+        if (s->sent < p->header_len) {
+            from = p->header + s->sent;
+            left = p->header_len - s->sent;
+        } else if (s->sent < p->header_len + p->send_len) {
+            from = p->send + (s->sent - p->header_len);
+            left = p->header_len + p->send_len - s->sent;
+        } else {
+            shutdown(s->fd, SHUT_WR);
+            return false;
+        }
+
+        const ssize_t put = send(s->fd, from, left, MSG_NOSIGNAL);
+        if (put < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                return true;
+            s->failed = true;
+            return false;
+        }
+        s->sent += (size_t)put;
+    }
+}
+
+// Checks what the daemon sent back; returns false once the session is over.
+static bool receive_some(struct session *s, const struct script *p)
+{
+    static char buf[READ_CHUNK];
+    while (true) {
+        const ssize_t got = recv(s->fd, buf, sizeof buf, 0);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                return true;
+            s->failed = true;
+            return false;
+        }
+
+        if (got == 0) {
+            s->failed |= s->received != p->expect_len;
+            return false;
+        }
+
+        const size_t n = (size_t)got;
+        if (s->received + n > p->expect_len || memcmp(buf, p->expect + s->received, n) != 0)
+            s->failed = true;
+        s->received += n;
+    }
+}
+
+static void show_metrics(const char *path)
+{
+    const int fd = connect_to(path);
+    if (fd < 0)
+        return;
+
+    static const char request[] = "metrics\n";
+    if (write(fd, request, sizeof request - 1) == (ssize_t)(sizeof request - 1)) {
+        char buf[4096];
+        ssize_t got;
+        while ((got = read(fd, buf, sizeof buf)) > 0)
+            fwrite(buf, 1, (size_t)got, stdout);
+    }
+    close(fd);
+}
+
+static int parse_opts(struct options *o, int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "s:n:l:M:C:em")) != -1) {
+        switch (ch) {
+            case 's': o->path     = optarg;                         break;
+            case 'n': o->sessions = strtoul(optarg, NULL, 0);       break;
+            case 'l': o->length   = strtoul(optarg, NULL, 0);       break;
+            case 'M': o->profile  = optarg;                         break;
+            case 'C': o->channel  = strtol(optarg, NULL, 0);        break;
+            case 'e': o->encode   = true;                           break;
+            case 'm': o->metrics  = true;                           break;
+
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct options opts = {
+        .path     = TYNSELD_SOCKET,
+        .sessions = 100,
+        .length   = 256,
+        .profile  = "bell103",
+    };
+
+    if (parse_opts(&opts, argc, argv))
+        exit(EXIT_FAILURE);
+
+    const MODEM_PROFILE *profile = find_profile(opts.profile);
+    if (! profile) {
+        fprintf(stderr, "Unknown modem profile\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts.channel < 0 || opts.channel >= CHAN_max) {
+        fprintf(stderr, "Invalid channel %d\n", opts.channel);
+        exit(EXIT_FAILURE);
+    }
+
+    // printable, so that any mixup is easy to see
+    char *data = allocate(opts.length);
+    for (size_t i = 0; i < opts.length; i++)
+        data[i] = (char)(' ' + rand() % 95);
+
+    size_t samples = 0;
+    int16_t *pcm = synthesize(profile, (enum channel)opts.channel, opts.length, data, &samples);
+
+    struct script script;
+    script.header_len = (size_t)snprintf(script.header, sizeof script.header, "%s %s %d\n",
+            opts.encode ? "encode" : "decode", opts.profile, opts.channel);
+    if (opts.encode) {
+        script.send = data;
+        script.send_len = opts.length;
+        script.expect = (const char*)pcm;
+        script.expect_len = samples * sizeof *pcm;
+    } else {
+        script.send = (const char*)pcm;
+        script.send_len = samples * sizeof *pcm;
+        script.expect = data;
+        script.expect_len = opts.length;
+    }
+
+    const int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct session *sessions = allocate(opts.sessions * sizeof *sessions);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    unsigned open = 0;
+    for (unsigned i = 0; i < opts.sessions; i++) {
+        struct session *s = &sessions[i];
+        *s = (struct session){ .fd = connect_to(opts.path) };
+        if (s->fd < 0)
+            exit(EXIT_FAILURE);
+
+        if (fcntl(s->fd, F_SETFL, O_NONBLOCK) != 0) {
+            perror("fcntl failed");
+            exit(EXIT_FAILURE);
+        }
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.ptr = s };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev) != 0) {
+            perror("epoll_ctl failed");
+            exit(EXIT_FAILURE);
+        }
+        open++;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (open > 0) {
+        const int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct session *s = events[i].data.ptr;
+            const uint32_t e = events[i].events;
+
+            if ((e & EPOLLOUT) && ! send_some(s, &script)) {
+                struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+                epoll_ctl(epfd, EPOLL_CTL_MOD, s->fd, &ev);
+            }
+
+            if ((e & (EPOLLIN | EPOLLHUP | EPOLLERR)) && ! receive_some(s, &script)) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, s->fd, NULL);
+                close(s->fd);
+                open--;
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    unsigned failed = 0;
+    for (unsigned i = 0; i < opts.sessions; i++)
+        failed += sessions[i].failed;
+
+    const double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    const double rate = (double)samples * opts.sessions / seconds;
+    printf("%u %s sessions of %zu bytes (%zu samples) each, %u failed\n",
+            opts.sessions, opts.encode ? "encode" : "decode", opts.length, samples, failed);
+    printf("%.3f s, %.2f Msamples/s, %.1f real-time sessions\n", seconds, rate * 1e-6, rate / SAMPLE_RATE);
+
+    if (opts.metrics)
+        show_metrics(opts.path);
+
+    free(sessions);
+    free(pcm);
+    free(data);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
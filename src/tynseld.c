@@ -0,0 +1,629 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+// Multiplexes many decode and encode sessions (see tynseld.h) over a few
+// worker threads. Each worker waits on its own epoll set, which holds the
+// listening socket (shared, with EPOLLEXCLUSIVE, so that one worker wakes
+// for each connection) and the sessions that it has been handed.
+
+#define _GNU_SOURCE
+
+#include "coeff.h"
+#include "decode.h"
+#include "encode.h"
+#include "profile.h"
+#include "sine.h"
+#include "state.h"
+#include "tynseld.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// input bytes read at a time for a decode session
+enum { READ_CHUNK = 65536 };
+// input bytes read at a time for an encode session, each of which becomes
+// hundreds of samples
+enum { ENCODE_READ = 64 };
+// samples synthesized per call to an encode_filler
+enum { ENCODE_SAMPLES = 1024 };
+// queued output beyond which a session's input is left unread
+enum { QUEUE_HIGH = 262144 };
+enum { MAX_EVENTS = 64 };
+enum { MAX_WORKERS = 64 };
+
+static const SERIAL_CONFIG serial = {
+    .data_bits   = 8,
+    .parity_bits = 0,
+    .stop_bits   = 2,
+};
+
+decode_init decode_state_init16;
+decode_selector select_decoder16;
+decode_fini decode_state_fini16;
+encode_init encode_state_init;
+encode_fini encode_state_fini;
+
+sines_init init_sines16;
+profile_init init_profile16;
+encode_filler encode_bytes_block16, encode_carrier_block16;
+
+// Output waiting to be written
+struct queue {
+    char *buf;
+    size_t pos, len, cap;
+};
+
+enum kind { HEADER, DECODE, ENCODE, METRICS };
+
+struct session {
+    int fd;
+    enum kind kind;
+    uint32_t events;        // what the session is registered for
+    bool input_done;
+    struct queue out;
+    char header[TYNSELD_HEADER_MAX];
+    size_t header_len;
+
+    // decode sessions
+    AUDIO_CONFIG audio;
+    struct filter_config coeffs[CHAN_max * BIT_max];
+    decode_pumper *pump;
+    DECODE_STATE *decoder;
+    char odd[1];            // half a sample, left over from the last read
+    bool have_odd;
+
+    // encode sessions
+    BYTE_STATE *encoder;
+    size_t padding;         // words of carrier on each end
+};
+
+struct worker {
+    pthread_t thread;
+    int epfd;
+    int listener;
+    unsigned index;
+
+    atomic_uint_least64_t samples;      // decoded or encoded
+    atomic_uint_least64_t total;        // sessions accepted
+    atomic_uint active;                 // sessions open
+    atomic_size_t queued;               // output bytes waiting
+    atomic_size_t deepest;              // the most that any session has had
+};
+
+// shared by every encoder, which all use the same gain
+static const void *sines;
+
+static struct {
+    unsigned count;
+    struct worker workers[MAX_WORKERS];
+    struct timespec started;
+    atomic_uint next;                   // the worker for the next session
+
+    pthread_mutex_t lock;               // for the rest
+    struct timespec last_time;
+    uint64_t last_samples;
+} daemon_state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static double seconds_since(const struct timespec *then, const struct timespec *now)
+{
+    return (double)(now->tv_sec - then->tv_sec) + (now->tv_nsec - then->tv_nsec) * 1e-9;
+}
+
+static void *reserve(struct queue *q, size_t size)
+{
+    if (q->pos > 0 && q->len + size > q->cap) {
+        memmove(q->buf, q->buf + q->pos, q->len - q->pos);
+        q->len -= q->pos;
+        q->pos = 0;
+    }
+
+    if (q->len + size > q->cap) {
+        size_t cap = q->cap ? q->cap : 4096;
+        while (cap < q->len + size)
+            cap *= 2;
+        char *buf = realloc(q->buf, cap);
+        if (! buf) {
+            fprintf(stderr, "Failed to allocate %zu bytes\n", cap);
+            exit(EXIT_FAILURE);
+        }
+        q->buf = buf;
+        q->cap = cap;
+    }
+
+    return q->buf + q->len;
+}
+
+static void commit(struct worker *w, struct session *s, size_t size)
+{
+    s->out.len += size;
+    const size_t queued = s->out.len - s->out.pos;
+    atomic_fetch_add_explicit(&w->queued, size, memory_order_relaxed);
+
+    size_t deepest = atomic_load_explicit(&w->deepest, memory_order_relaxed);
+    while (queued > deepest && ! atomic_compare_exchange_weak_explicit(&w->deepest, &deepest, queued, memory_order_relaxed, memory_order_relaxed))
+        ; // `deepest` was reloaded
+}
+
+static void say(struct worker *w, struct session *s, const char *text)
+{
+    const size_t len = strlen(text);
+    memcpy(reserve(&s->out, len), text, len);
+    commit(w, s, len);
+}
+
+static void metrics(struct worker *w, struct session *s)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t samples = 0, total = 0;
+    unsigned active = 0;
+    size_t queued = 0;
+    char line[256];
+    for (unsigned i = 0; i < daemon_state.count; i++) {
+        struct worker *v = &daemon_state.workers[i];
+        const uint64_t vs = atomic_load(&v->samples);
+        const uint64_t vt = atomic_load(&v->total);
+        const unsigned va = atomic_load(&v->active);
+        const size_t vq = atomic_load(&v->queued);
+        snprintf(line, sizeof line, "worker %u sessions %u total %llu samples %llu queued %zu deepest %zu\n",
+                i, va, (unsigned long long)vt, (unsigned long long)vs, vq, atomic_load(&v->deepest));
+        say(w, s, line);
+
+        samples += vs;
+        total += vt;
+        active += va;
+        queued += vq;
+    }
+
+    pthread_mutex_lock(&daemon_state.lock);
+    const double interval = seconds_since(&daemon_state.last_time, &now);
+    const double recent = interval > 0 ? (samples - daemon_state.last_samples) / interval : 0;
+    daemon_state.last_time = now;
+    daemon_state.last_samples = samples;
+    pthread_mutex_unlock(&daemon_state.lock);
+
+    const double uptime = seconds_since(&daemon_state.started, &now);
+    snprintf(line, sizeof line, "total sessions %u total %llu samples %llu queued %zu\n"
+            "uptime %.3f samples/s %.0f recent samples/s %.0f\n",
+            active, (unsigned long long)total, (unsigned long long)samples, queued,
+            uptime, uptime > 0 ? samples / uptime : 0, recent);
+    say(w, s, line);
+}
+
+// Encodes one word of `byte` (or of carrier), writing the samples up to and
+// including the one that accepted it
+static void encode_word(struct worker *w, struct session *s, encode_filler *fill, char byte)
+{
+    for (bool accepted = false; ! accepted; /* set inside loop */) {
+        void *out = reserve(&s->out, ENCODE_SAMPLES * sizeof(int16_t));
+        const size_t n = fill(&serial, s->encoder, true, s->encoder->channel, byte, &accepted, ENCODE_SAMPLES, out);
+        commit(w, s, n * sizeof(int16_t));
+        atomic_fetch_add_explicit(&w->samples, n, memory_order_relaxed);
+    }
+}
+
+// the padding and draining that `gen` puts after its input
+static void encode_end(struct worker *w, struct session *s)
+{
+    for (size_t i = 0; i < s->padding; i++)
+        encode_word(w, s, encode_carrier_block16, 0);
+
+    // drain the encoder, leaving off the sample that accepted the last word
+    for (bool accepted = false; ! accepted; /* set inside loop */) {
+        void *out = reserve(&s->out, ENCODE_SAMPLES * sizeof(int16_t));
+        const size_t n = encode_carrier_block16(&serial, s->encoder, true, s->encoder->channel, 0, &accepted, ENCODE_SAMPLES, out);
+        commit(w, s, (n - accepted) * sizeof(int16_t));
+        atomic_fetch_add_explicit(&w->samples, n - accepted, memory_order_relaxed);
+    }
+}
+
+static void decode_samples(struct worker *w, struct session *s, size_t len, char *in)
+{
+    int16_t sample;
+    size_t i = 0;
+    if (s->have_odd && len > 0) {
+        char pair[2] = { s->odd[0], in[i++] };
+        memcpy(&sample, pair, sizeof sample);
+        s->have_odd = false;
+
+        char out = 0;
+        if (s->pump(&serial, &s->audio, &s->coeffs[s->audio.channel * BIT_max], s->decoder, &sample, &out)) {
+            *(char*)reserve(&s->out, 1) = out;
+            commit(w, s, 1);
+        }
+    }
+
+    const struct filter_config *coeffs = &s->coeffs[s->audio.channel * BIT_max];
+    size_t count = 0;
+    for (; i + sizeof sample <= len; i += sizeof sample, count++) {
+        memcpy(&sample, &in[i], sizeof sample);
+        char out = 0;
+        if (s->pump(&serial, &s->audio, coeffs, s->decoder, &sample, &out)) {
+            *(char*)reserve(&s->out, 1) = out;
+            commit(w, s, 1);
+        }
+    }
+
+    if (i < len) {
+        s->odd[0] = in[i];
+        s->have_odd = true;
+    }
+
+    atomic_fetch_add_explicit(&w->samples, count, memory_order_relaxed);
+}
+
+// Parses the header and sets up the session. Returns NULL once the session
+// has started, or why it could not.
+static const char *start(struct worker *w, struct session *s, char *header)
+{
+    static const char usage[] = "error: expected \"decode|encode <profile> <channel>\" or \"metrics\"\n";
+    static const char busy[] = "error: too many sessions\n";
+
+    char *save = NULL;
+    const char *verb = strtok_r(header, " \t\r", &save);
+    if (verb && strcmp(verb, "metrics") == 0) {
+        s->kind = METRICS;
+        metrics(w, s);
+        s->input_done = true;
+        return NULL;
+    }
+
+    const char *name = strtok_r(NULL, " \t\r", &save);
+    const char *chan = strtok_r(NULL, " \t\r", &save);
+    const MODEM_PROFILE *profile = name ? find_profile(name) : NULL;
+    const long channel = chan ? strtol(chan, NULL, 0) : -1;
+    if (! verb || ! profile || channel < 0 || channel >= CHAN_max)
+        return usage;
+
+    if (strcmp(verb, "decode") == 0) {
+        s->kind = DECODE;
+        s->audio = profile_audio(profile, (enum channel)channel, SAMPLE_RATE);
+        design_notches(s->coeffs, profile, SAMPLE_RATE);
+        s->pump = select_decoder16(&serial, &s->audio);
+        s->decoder = decode_state_init16();
+        return s->decoder ? NULL : busy;
+    }
+
+    if (strcmp(verb, "encode") == 0) {
+        s->kind = ENCODE;
+        s->encoder = encode_state_init();
+        if (! s->encoder)
+            return busy;
+        s->encoder->channel = (enum channel)channel;
+        s->encoder->bit_state.sample_state.quadrant = sines;
+        init_profile16(s->encoder, profile);
+
+        // Pad with about a second of carrier on each end, as `gen` does
+        s->padding = profile->baud_rate / (NUM_START_BITS + serial.data_bits + serial.parity_bits + serial.stop_bits);
+        for (size_t i = 0; i < s->padding; i++)
+            encode_word(w, s, encode_carrier_block16, 0);
+        return NULL;
+    }
+
+    return usage;
+}
+
+// Takes input that follows the header
+static void consume(struct worker *w, struct session *s, size_t len, char *in)
+{
+    if (s->kind == DECODE) {
+        decode_samples(w, s, len, in);
+    } else if (s->kind == ENCODE) {
+        for (size_t i = 0; i < len; i++)
+            encode_word(w, s, encode_bytes_block16, in[i]);
+    }
+}
+
+// Returns false when the session should be closed at once.
+static bool readable(struct worker *w, struct session *s)
+{
+    static _Thread_local char buf[READ_CHUNK];
+
+    if (s->input_done)
+        return true; // hung up, or nothing more is wanted
+
+    if (s->kind == HEADER) {
+        const ssize_t got = read(s->fd, s->header + s->header_len, sizeof s->header - s->header_len);
+        if (got <= 0)
+            return got < 0 && (errno == EAGAIN || errno == EINTR);
+
+        s->header_len += (size_t)got;
+        char *newline = memchr(s->header, '\n', s->header_len);
+        if (! newline) {
+            if (s->header_len < sizeof s->header)
+                return true; // wait for the rest
+            say(w, s, "error: header too long\n");
+            s->input_done = true;
+            return true;
+        }
+
+        *newline = '\0';
+        const char *error = start(w, s, s->header);
+        if (error) {
+            say(w, s, error);
+            s->input_done = true;
+            return true;
+        }
+
+        // whatever came after the header
+        char *rest = newline + 1;
+        consume(w, s, s->header_len - (size_t)(rest - s->header), rest);
+        return true;
+    }
+
+    const size_t want = s->kind == ENCODE ? ENCODE_READ : sizeof buf;
+    const ssize_t got = read(s->fd, buf, want);
+    if (got < 0)
+        return errno == EAGAIN || errno == EINTR;
+
+    if (got == 0) {
+        s->input_done = true;
+        if (s->kind == ENCODE)
+            encode_end(w, s);
+        return true;
+    }
+
+    consume(w, s, (size_t)got, buf);
+    return true;
+}
+
+// Returns false when the session should be closed at once.
+static bool writable(struct worker *w, struct session *s)
+{
+    while (s->out.pos < s->out.len) {
+        const ssize_t put = send(s->fd, s->out.buf + s->out.pos, s->out.len - s->out.pos, MSG_NOSIGNAL);
+        if (put < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN;
+        }
+
+        s->out.pos += (size_t)put;
+        atomic_fetch_sub_explicit(&w->queued, (size_t)put, memory_order_relaxed);
+    }
+
+    s->out.pos = s->out.len = 0;
+    return true;
+}
+
+static void close_session(struct worker *w, struct session *s)
+{
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    atomic_fetch_sub_explicit(&w->queued, s->out.len - s->out.pos, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&w->active, 1, memory_order_relaxed);
+    if (s->decoder)
+        decode_state_fini16(s->decoder);
+    if (s->encoder)
+        encode_state_fini(s->encoder);
+    free(s->out.buf);
+    free(s);
+}
+
+// Registers for input while there is room to queue what it makes, and for
+// output while any is queued; closes the session once both are done.
+static void update(struct worker *w, struct session *s)
+{
+    const size_t queued = s->out.len - s->out.pos;
+    const uint32_t events = (! s->input_done && queued < QUEUE_HIGH ? EPOLLIN : 0) | (queued > 0 ? EPOLLOUT : 0);
+
+    if (! events) {
+        close_session(w, s);
+        return;
+    }
+
+    if (events != s->events) {
+        struct epoll_event ev = { .events = events, .data.ptr = s };
+        epoll_ctl(w->epfd, EPOLL_CTL_MOD, s->fd, &ev);
+        s->events = events;
+    }
+}
+
+// Accepts a connection, and hands it to the workers in turn, so that they
+// share the sessions evenly however busy the one that woke up is.
+static void accept_session(struct worker *waker)
+{
+    const int fd = accept4(waker->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+            perror("accept failed");
+        return;
+    }
+
+    struct session *s = calloc(1, sizeof *s);
+    if (! s) {
+        close(fd);
+        return;
+    }
+
+    const unsigned turn = atomic_fetch_add_explicit(&daemon_state.next, 1, memory_order_relaxed);
+    struct worker *w = &daemon_state.workers[turn % daemon_state.count];
+
+    *s = (struct session){ .fd = fd, .kind = HEADER, .events = EPOLLIN };
+    struct epoll_event ev = { .events = s->events, .data.ptr = s };
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        perror("epoll_ctl failed");
+        close(fd);
+        free(s);
+        return;
+    }
+
+    atomic_fetch_add_explicit(&w->total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&w->active, 1, memory_order_relaxed);
+}
+
+static void *work(void *arg)
+{
+    struct worker *w = arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        const int n = epoll_wait(w->epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct session *s = events[i].data.ptr;
+            if (! s) {
+                accept_session(w);
+                continue;
+            }
+
+            const uint32_t e = events[i].events;
+            bool ok = true;
+            if (e & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                ok = readable(w, s);
+            // Write as soon as there is output, rather than waiting for
+            // EPOLLOUT; the socket usually has room.
+            if (ok && s->out.pos < s->out.len)
+                ok = writable(w, s);
+
+            if (ok)
+                update(w, s);
+            else
+                close_session(w, s);
+        }
+    }
+
+    return NULL;
+}
+
+static int listen_on(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "Socket path too long : %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket failed");
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof addr) != 0 || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Failed to listen on %s : %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int parse_opts(const char **path, unsigned *workers, int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "s:j:")) != -1) {
+        switch (ch) {
+            case 's': *path    = optarg;                        break;
+            case 'j': *workers = strtoul(optarg, NULL, 0);      break;
+
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = TYNSELD_SOCKET;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned count = cores > 0 ? (unsigned)cores : 1;
+    if (parse_opts(&path, &count, argc, argv))
+        exit(EXIT_FAILURE);
+
+    if (count < 1 || count > MAX_WORKERS) {
+        fprintf(stderr, "Number of workers must be between 1 and %d\n", MAX_WORKERS);
+        exit(EXIT_FAILURE);
+    }
+
+    init_sines16(&sines, 0.5);
+
+    const int listener = listen_on(path);
+    if (listener < 0)
+        exit(EXIT_FAILURE);
+
+    // The workers leave SIGINT and SIGTERM to the main thread, which cleans
+    // up the socket.
+    sigset_t stop;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &daemon_state.started);
+    daemon_state.last_time = daemon_state.started;
+    daemon_state.count = count;
+
+    // A worker may hand a new session to any other, so every epoll set must
+    // exist before the first worker starts accepting.
+    for (unsigned i = 0; i < count; i++) {
+        struct worker *w = &daemon_state.workers[i];
+        w->index = i;
+        w->listener = listener;
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+        if (w->epfd < 0 || epoll_ctl(w->epfd, EPOLL_CTL_ADD, listener, &ev) != 0) {
+            perror("epoll setup failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        struct worker *w = &daemon_state.workers[i];
+        const int rc = pthread_create(&w->thread, NULL, work, w);
+        if (rc) {
+            fprintf(stderr, "Failed to start thread : %s\n", strerror(rc));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int sig = 0;
+    sigwait(&stop, &sig);
+    unlink(path);
+
+    return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef TYNSELD_H_
+#define TYNSELD_H_
+
+// `tynseld` serves modem sessions over a Unix-domain stream socket. A session
+// starts with one line of text naming what the client wants:
+//
+//   decode <profile> <channel>\n   then 16-bit PCM in, decoded bytes out
+//   encode <profile> <channel>\n   then bytes in, 16-bit PCM out, as `gen`
+//                                  would make it
+//   metrics\n                      a snapshot of the daemon's counters, as
+//                                  text
+//
+// Both directions use 8N2 framing. Once the client shuts down its side of the
+// connection, the daemon finishes the output and closes the session. A header
+// that cannot be understood, or that comes when the daemon already has as many
+// sessions as it holds state for, gets a line starting with "error" in reply.
+
+#define TYNSELD_SOCKET "/tmp/tynseld.sock"
+
+enum { TYNSELD_HEADER_MAX = 64 };
+
+#endif
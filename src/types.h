@@ -54,9 +54,17 @@ enum { NUM_START_BITS = 1 };
 #error "#define SAMPLE_RATE in Hz"
 #endif
 
-static const unsigned int BAUD_RATE = 300;
-static const unsigned int SAMPLES_PER_BIT = (SAMPLE_RATE + BAUD_RATE / 2) / BAUD_RATE; // round to nearest
+// Bit timing is kept in fractions of a sample, so that bit periods that are
+// not a whole number of samples (26.67 at 8000Hz and 300 baud) do not
+// accumulate error across a word.
+#define BIT_CLOCK_FRACTION_BITS 6
+#define BIT_CLOCK_ONE (1 << BIT_CLOCK_FRACTION_BITS)
+// Samples per bit in units of 1/BIT_CLOCK_ONE samples, rounded to nearest.
+// Rate / Baud must be less than 512 for the result to fit in an int16_t.
+#define BIT_PERIOD(Rate,Baud) \
+    ((uint16_t)((((uint32_t)(Rate) << BIT_CLOCK_FRACTION_BITS) + (Baud) / 2) / (Baud)))
 
+// The Bell 103 frequencies, which are the only ones built into coeff_table.
 #define FREQUENCY_LIST(_) \
     _(CHAN_ZERO, BIT_ZERO, 1070) \
     _(CHAN_ZERO, BIT_ONE , 1270) \
@@ -64,4 +72,17 @@ static const unsigned int SAMPLES_PER_BIT = (SAMPLE_RATE + BAUD_RATE / 2) / BAUD
     _(CHAN_ONE , BIT_ONE , 2225) \
     // end macro
 
+#define INIT_2D_ARRAY(X,Y,Z) [X][Y] = Z,
+
+typedef struct {
+    uint16_t baud_rate;
+    uint16_t notch_width; // in Hz
+    uint16_t frequencies[CHAN_max][BIT_max];
+
+    // Decoder defaults (see AUDIO_CONFIG), as tuned at 8000Hz
+    uint8_t window_size;
+    int8_t hysteresis;
+    int8_t offset;
+} MODEM_PROFILE;
+
 #endif
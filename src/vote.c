@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "vote.h"
+
+void vote_init(struct vote *v, unsigned members, uint64_t window)
+{
+    *v = (struct vote){
+        .members = members,
+        .window  = window,
+    };
+}
+
+// Closes the open vote, tallying it, and returns whether it yielded a byte
+static bool decide(struct vote *v, char *decided)
+{
+    unsigned best = 0, best_count = 0;
+    for (unsigned m = 0; m < v->members; m++) {
+        if (! (v->cast & (1u << m)))
+            continue;
+
+        unsigned count = 0;
+        for (unsigned n = m; n < v->members; n++)
+            count += (v->cast & (1u << n)) && v->ballot[n] == v->ballot[m];
+
+        if (count > best_count) {
+            best = m;
+            best_count = count;
+        }
+    }
+
+    const bool yielded = best_count * 2 > v->members;
+    const char byte = v->ballot[best];
+
+    v->votes++;
+    v->unanimous += best_count == v->members;
+    v->dropped += ! yielded;
+    for (unsigned m = 0; m < v->members; m++) {
+        if (! (v->cast & (1u << m)))
+            v->missing[m]++;
+        else if (! yielded || v->ballot[m] != byte)
+            v->dissent[m]++;
+    }
+
+    v->cast = 0;
+    *decided = byte;
+    return yielded;
+}
+
+size_t vote_cast(struct vote *v, uint64_t sample, unsigned cast, const char ballot[], char decided[])
+{
+    size_t n = 0;
+    if (v->cast && sample - v->opened >= v->window)
+        n += decide(v, &decided[n]);
+
+    const unsigned all = (1u << v->members) - 1;
+    for (unsigned m = 0; cast; m++) {
+        const unsigned bit = 1u << m;
+        if (! (cast & bit))
+            continue;
+        cast &= ~bit;
+
+        if (v->cast & bit)
+            n += decide(v, &decided[n]);
+        if (! v->cast)
+            v->opened = sample;
+
+        v->cast |= bit;
+        v->ballot[m] = ballot[m];
+        if (v->cast == all)
+            n += decide(v, &decided[n]);
+    }
+
+    return n;
+}
+
+size_t vote_flush(struct vote *v, char decided[])
+{
+    return v->cast ? decide(v, decided) : 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2020 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef VOTE_H_
+#define VOTE_H_
+
+#include "decode.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The members of an ensemble (see decode.h) complete the same byte at
+// slightly different samples, since each sees the bit edges through its own
+// windows and offset. A vote opens at the first member's byte, and closes
+// when every member has given one or `window` samples later, whichever comes
+// first; a member giving a second byte while the vote is open closes it too.
+// The vote yields the byte that more than half of all the members gave, or
+// nothing if there is no such byte, so an ensemble should have an odd number
+// of members.
+
+struct vote {
+    unsigned members;
+    uint64_t window;            // samples a vote stays open
+    uint64_t opened;            // the sample of the open vote's first byte
+    unsigned cast;              // mask of the members that gave one, if open
+    char ballot[ENSEMBLE_MAX];
+
+    // Tallies, for judging the members
+    uint64_t votes;             // held in all
+    uint64_t unanimous;         // where every member gave the same byte
+    uint64_t dropped;           // that yielded nothing
+    uint64_t missing[ENSEMBLE_MAX]; // where the member gave nothing
+    uint64_t dissent[ENSEMBLE_MAX]; // where the member's byte was not the one yielded
+};
+
+void vote_init(struct vote *v, unsigned members, uint64_t window);
+
+// Gives the vote the bytes in `ballot` of the members in the mask `cast`,
+// completed at `sample`, which must not go backward between calls. It should
+// be called for every sample, even with no bytes, so that open votes close on
+// time. Writes the bytes decided to `decided`, which must have room for
+// ENSEMBLE_MAX + 1, and returns how many there were.
+size_t vote_cast(struct vote *v, uint64_t sample, unsigned cast, const char ballot[], char decided[]);
+
+// Closes the open vote, if any, at the end of the input. Returns the number
+// of bytes (zero or one) written to `decided`.
+size_t vote_flush(struct vote *v, char decided[]);
+
+#endif